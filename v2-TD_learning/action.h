@@ -23,16 +23,12 @@ public:
 	class place; // create a placing action with position and tile
 
 public:
-	virtual board::reward apply(board& b) const {
-		auto proto = entries().find(type());
-		if (proto != entries().end()) return proto->second->reinterpret(this).apply(b);
-		return -1;
-	}
-	virtual std::ostream& operator >>(std::ostream& out) const {
-		auto proto = entries().find(type());
-		if (proto != entries().end()) return proto->second->reinterpret(this) >> out;
-		return out << "??";
-	}
+	/**
+	 * slides and placements are dispatched by switching on type(), without touching the
+	 * prototypes; the prototypes are only needed for other registered types, and for parsing
+	 */
+	virtual board::reward apply(board& b) const;
+	virtual std::ostream& operator >>(std::ostream& out) const;
 	virtual std::istream& operator <<(std::istream& in) {
 		auto state = in.rdstate();
 		for (auto proto = entries().begin(); proto != entries().end(); proto++) {
@@ -124,3 +120,23 @@ protected:
 	action& reinterpret(const action* a) const { return *new (const_cast<action*>(a)) place(*a); }
 	static __attribute__((constructor)) void init() { entries()[type_flag('p')] = new place; }
 };
+
+inline board::reward action::apply(board& b) const {
+	switch (type()) {
+	case slide::type: return slide(*this).apply(b);
+	case place::type: return place(*this).apply(b);
+	}
+	auto proto = entries().find(type());
+	if (proto != entries().end()) return proto->second->reinterpret(this).apply(b);
+	return -1;
+}
+
+inline std::ostream& action::operator >>(std::ostream& out) const {
+	switch (type()) {
+	case slide::type: return slide(*this) >> out;
+	case place::type: return place(*this) >> out;
+	}
+	auto proto = entries().find(type());
+	if (proto != entries().end()) return proto->second->reinterpret(this) >> out;
+	return out << "??";
+}
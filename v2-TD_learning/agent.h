@@ -9,7 +9,6 @@
 
 #pragma once
 #include <string>
-#include <random>
 #include <sstream>
 #include <map>
 #include <vector>
@@ -17,28 +16,34 @@
 #include <type_traits>
 #include <algorithm>
 #include <fstream>
+#include <memory>
+#include <atomic>
+#include <iomanip>
+#include <chrono>
+#include <mutex>
+#include <functional>
+#include <sys/wait.h>
 #include "board.h"
+#include "bitboard.h"
 #include "action.h"
 #include "weight.h"
+#include "archive.h"
+#include "feature.h"
+#include "evaluator.h"
+#include "transposition.h"
+#include "profile.h"
+#include "xoshiro.h"
+#include "pool.h"
 
 
-static const int featureSize = 6;
-static const int featureSize2 = 4;
-static const int featureNum = 6;
-
-const std::array<std::array<int, featureSize> ,featureNum> feature = {{
-	{{0,1,2,3,4,5}},
-
-	{{4,5,6,7,8,9}},
-		
-	{{5,6,7,9,10,11}},
-
-	{{9,10,11,13,14,15}},
-	
-	{{0,1,2,4}},
-
-	{{2,5,6,9}}
-}};
+/**
+ * the n-tuple networks of tdLearning_slider, as compile-time pattern lists (see network)
+ * six_tuples has four 6-tuples and two 4-tuples, and four_tuples is the 8x4-tuple network
+ */
+typedef network<ntuple<0, 1, 2, 3, 4, 5>, ntuple<4, 5, 6, 7, 8, 9>, ntuple<5, 6, 7, 9, 10, 11>, ntuple<9, 10, 11, 13, 14, 15>,
+	ntuple<0, 1, 2, 4>, ntuple<2, 5, 6, 9>> six_tuples;
+typedef network<ntuple<0, 1, 2, 3>, ntuple<4, 5, 6, 7>, ntuple<0, 1, 4, 5>, ntuple<1, 2, 5, 6>,
+	ntuple<5, 6, 9, 10>, ntuple<0, 1, 2, 4>, ntuple<1, 2, 3, 5>, ntuple<2, 5, 6, 9>> four_tuples;
 
 class agent {
 public:
@@ -74,7 +79,7 @@ protected:
 };
 
 /**
- * base agent for agents with randomness
+ * base agent for agents with randomness, driven by a fast generator (see xoshiro.h)
  */
 class random_agent : public agent {
 public:
@@ -84,26 +89,95 @@ public:
 	}
 	virtual ~random_agent() {}
 
+	/**
+	 * restart the generator, e.g., from a seed derived for each game
+	 */
+	void seed(uint64_t seed) { engine.seed(seed); }
+
+	/**
+	 * the seed of a game derived from the base seed and the game id
+	 */
+	static uint64_t seed(unsigned base, size_t game) { return (uint64_t(base) << 32) ^ game; }
+
 protected:
-	std::default_random_engine engine;
+	xoshiro engine;
 };
 
 /**
  * base agent for agents with weight tables and a learning rate
+ *
+ * an agent built with tuple shapes indexes each table with one digit of
+ * the radix per cell (radix=16 packs the 4-bit tiles, a smaller radix
+ * clamps large tiles), and the tables declared by init= or load= are
+ * checked against these shapes; init without sizes allocates them
+ *
+ * with quantize, the float tables are converted into 16-bit tables (see quantized),
+ * which are used for evaluation; an archive of 16-bit tables is mapped into qnet only
+ *
+ * pages= and numa= select how the large tables are allocated (see pages.h)
  */
 class weight_agent : public agent {
 public:
-	weight_agent(const std::string& args = "") : agent(args), alpha(0.1/48) {
+	typedef std::vector<std::vector<unsigned>> shapes;
+
+public:
+	weight_agent(const std::string& args = "", const shapes& tuples = {}) : agent(args),
+		model(std::make_shared<std::vector<weight>>()), net(*model),
+		qmodel(std::make_shared<std::vector<quantized>>()), qnet(*qmodel), alpha(0.1/48), tuples(tuples), radix(0),
+		snapshot(std::make_shared<checkpoint_state>()), ckpt_every(0), replicas(std::make_shared<replica_set>()) {
+		if (meta.find("alpha") != meta.end())
+			alpha = float(meta["alpha"]);
+		if (meta.find("pages") != meta.end() || meta.find("numa") != meta.end())
+			pages::configure(meta.find("pages") != meta.end() ? property("pages") : "normal",
+				meta.find("numa") != meta.end() ? property("numa") : "local");
+		if (meta.find("radix") != meta.end())
+			radix = size_t(meta["radix"]);
 		if (meta.find("init") != meta.end())
 			init_weights(meta["init"]);
 		if (meta.find("load") != meta.end())
 			load_weights(meta["load"]);
-		if (meta.find("alpha") != meta.end())
-			alpha = float(meta["alpha"]);
+		if (meta.find("map") != meta.end())
+			map_weights(meta["map"]);
+		if (meta.find("quantize") != meta.end())
+			quantize_weights();
+		if (qnet.size() && alpha != 0) {
+			std::cerr << name() << ": quantized tables cannot be trained, use alpha=0" << std::endl;
+			std::exit(-1);
+		}
+		if (tuples.size())
+			init_features();
+		if (meta.find("checkpoint") != meta.end()) {
+			std::string info = meta["checkpoint"]; // e.g., "weights.bin,every=1000"
+			ckpt_path = info.substr(0, info.find(','));
+			if (info.find("every=") != std::string::npos)
+				ckpt_every = std::stoull(info.substr(info.find("every=") + 6));
+		}
+	}
+	/**
+	 * fork a worker that shares the tables of the given agent, e.g., for another thread
+	 * the worker never saves the shared tables
+	 *
+	 * with numa=replicate, a worker of a read-only agent uses the replica of the node it is forked on
+	 */
+	weight_agent(const weight_agent& a) : agent(a),
+		model(a.replica()), net(*model), qmodel(a.qmodel), qnet(*qmodel), alpha(a.alpha), tuples(a.tuples), radix(a.radix), features(a.features),
+		snapshot(a.snapshot), ckpt_path(a.ckpt_path), ckpt_every(a.ckpt_every), replicas(a.replicas) {
+		meta.erase("save");
+		meta.erase("export");
 	}
 	virtual ~weight_agent() {
+		if (snapshot.use_count() == 1) wait_checkpoint(true);
 		if (meta.find("save") != meta.end())
 			save_weights(meta["save"]);
+		if (meta.find("export") != meta.end())
+			export_weights(meta["export"]);
+	}
+
+	/**
+	 * with checkpoint=path,every=N, snapshot the tables every N episodes (counted over all forks)
+	 */
+	virtual void close_episode(const std::string& flag = "") {
+		if (ckpt_every && ++(snapshot->episodes) % ckpt_every == 0) checkpoint();
 	}
 
 protected:
@@ -113,8 +187,11 @@ protected:
 			if (!std::isdigit(ch)) ch = ' ';
 		std::stringstream in(res);
 		for (size_t size; in >> size; net.emplace_back(size));
+		if (net.empty())
+			for (const auto& cells : tuples) net.emplace_back(table_size(cells.size(), radix ?: 20));
 	}
 	virtual void load_weights(const std::string& path) {
+		if (archive::detect(path)) return map_weights(path);
 		std::ifstream in(path, std::ios::in | std::ios::binary);
 		if (!in.is_open()) std::exit(-1);
 		uint32_t size;
@@ -124,6 +201,10 @@ protected:
 		in.close();
 	}
 	virtual void save_weights(const std::string& path) {
+		if (net.empty() && qnet.size()) {
+			std::cerr << name() << ": quantized tables cannot be saved as float, use export=" << std::endl;
+			return;
+		}
 		std::ofstream out(path, std::ios::out | std::ios::binary | std::ios::trunc);
 		if (!out.is_open()) std::exit(-1);
 		uint32_t size = net.size();
@@ -132,10 +213,194 @@ protected:
 		out.close();
 	}
 
+	/**
+	 * map the tables of an archive (see archive.h) instead of reading them
+	 * the mapping is read-only and shared if alpha is 0, or copy-on-write otherwise
+	 */
+	virtual void map_weights(const std::string& path) {
+		shapes stored;
+		uint32_t base;
+		try {
+			if (archive::element(path) == sizeof(quantized::type))
+				qnet = archive::map<quantized>(path, stored, base);
+			else
+				net = archive::map<weight>(path, stored, base, alpha != 0);
+		} catch (std::exception& e) {
+			std::cerr << name() << ": " << e.what() << std::endl;
+			std::exit(-1);
+		}
+		if (tuples.size() && stored != tuples) {
+			std::cerr << name() << ": the tuple shapes of " << path << " differ from the agent" << std::endl;
+			std::exit(-1);
+		}
+		if (radix && radix != base) {
+			std::cerr << name() << ": " << path << " has radix " << base << ", but radix " << radix << " is requested" << std::endl;
+			std::exit(-1);
+		}
+		radix = base;
+		std::cerr << name() << ": mapped " << path << (alpha != 0 ? " (copy-on-write)" : " (read-only, shared)") << std::endl;
+	}
+	virtual void export_weights(const std::string& path) {
+		try {
+			size_t count = qnet.size() ?: net.size();
+			if (qnet.size())
+				archive::save(path, qnet, tuples.size() ? tuples : shapes(count), radix ?: 20);
+			else
+				archive::save(path, net, tuples.size() ? tuples : shapes(count), radix ?: 20);
+		} catch (std::exception& e) {
+			std::cerr << name() << ": " << e.what() << std::endl;
+			std::exit(-1);
+		}
+	}
+
+	virtual void quantize_weights() {
+		qnet.assign(net.begin(), net.end());
+	}
+
+	/**
+	 * check the tables against the tuple shapes and build the extractor
+	 * if no radix is given, it is inferred from the size of the first table
+	 */
+	virtual void init_features() {
+		std::vector<size_t> sizes;
+		for (const weight& w : net) sizes.push_back(w.size());
+		if (net.empty())
+			for (const quantized& w : qnet) sizes.push_back(w.size());
+		if (sizes.empty()) return; // no network, e.g., to convert or review the logs with --total=0
+		if (!radix)
+			for (size_t r = 2; r <= 20 && !radix; r++)
+				if (table_size(tuples[0].size(), r) == sizes[0]) radix = r;
+		if (!radix) radix = 20;
+		if (sizes.size() != tuples.size()) {
+			std::cerr << name() << ": " << sizes.size() << " tables declared, but " << tuples.size() << " tuples expected" << std::endl;
+			std::exit(-1);
+		}
+		for (size_t i = 0; i < tuples.size(); i++) {
+			if (sizes[i] == table_size(tuples[i].size(), radix)) continue;
+			std::cerr << name() << ": table " << i << " has " << sizes[i] << " entries, but the "
+				<< tuples[i].size() << "-tuple requires " << table_size(tuples[i].size(), radix) << " with radix " << radix << std::endl;
+			std::exit(-1);
+		}
+		features = feature_set(tuples, radix);
+
+		size_t bytes = 0;
+		for (const weight& w : net) bytes += w.size() * sizeof(weight::type);
+		for (const quantized& w : qnet) bytes += w.size() * sizeof(quantized::type);
+		std::ios ff(nullptr);
+		ff.copyfmt(std::cerr);
+		std::cerr << std::fixed << std::setprecision(1);
+		std::cerr << name() << ": net = " << sizes.size() << " tables" << (qnet.size() ? " (quantized)" : "") << ", ";
+		std::cerr << bytes << " bytes (" << (bytes / 1048576.0) << " MB), radix = " << radix << std::endl;
+		std::cerr.copyfmt(ff);
+		if (pages::size() != pages::normal || pages::numa() != pages::local)
+			std::cerr << name() << ": " << pages::report() << std::endl;
+	}
+
+	/**
+	 * the tables of the node of the calling thread, copied (and bound to the node) on first use
+	 * if the tables are replicated, or the shared tables otherwise
+	 */
+	std::shared_ptr<std::vector<weight>> replica() const {
+		if (pages::numa() != pages::replicate || alpha != 0 || pages::nodes() < 2 || net.empty()) return model;
+		int node = pages::current_node();
+		std::lock_guard<std::mutex> guard(replicas->lock);
+		std::shared_ptr<std::vector<weight>>& copy = replicas->tables[node];
+		if (!copy) {
+			pages::binding bind(node);
+			copy = std::make_shared<std::vector<weight>>(*model);
+			std::cerr << name() << ": replicated the tables on node " << node << std::endl;
+		}
+		return copy;
+	}
+
+	/**
+	 * write the tables in the save= format from a forked child process, whose copy-on-write
+	 * view of the memory is a consistent snapshot, while this process continues training
+	 *
+	 * the child writes into path.tmp with plain system calls (it must not allocate, since
+	 * other threads may hold locks at fork time), then renames it to path atomically;
+	 * a checkpoint is skipped if the previous one is still being written
+	 */
+	void checkpoint() {
+		std::unique_lock<std::mutex> lock(snapshot->lock, std::try_to_lock);
+		if (!lock.owns_lock() || !wait_checkpoint(false)) return;
+		std::string temp = ckpt_path + ".tmp";
+		pid_t pid = ::fork();
+		if (pid == 0) {
+			int fd = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+			auto put = [fd](const void* buf, size_t len) -> bool {
+				for (const char* p = static_cast<const char*>(buf); len; ) {
+					ssize_t n = ::write(fd, p, len);
+					if (n <= 0) return false;
+					p += n, len -= n;
+				}
+				return true;
+			};
+			uint32_t size = net.size();
+			bool ok = fd >= 0 && put(&size, sizeof(size));
+			for (size_t i = 0; ok && i < net.size(); i++) {
+				uint64_t len = net[i].size();
+				ok = put(&len, sizeof(len)) && put(net[i].data(), sizeof(weight::type) * len);
+			}
+			ok = ok && ::fsync(fd) == 0 && ::close(fd) == 0 && ::rename(temp.c_str(), ckpt_path.c_str()) == 0;
+			::_exit(ok ? 0 : 1);
+		}
+		if (pid < 0) std::cerr << name() << ": cannot fork for checkpoint " << ckpt_path << std::endl;
+		snapshot->child = pid > 0 ? pid : 0;
+	}
+
+	/**
+	 * reap the last checkpoint child, return whether it has finished
+	 */
+	bool wait_checkpoint(bool block) {
+		if (!snapshot->child) return true;
+		int status = 0;
+		pid_t pid = ::waitpid(snapshot->child, &status, block ? 0 : WNOHANG);
+		if (pid == 0) return false;
+		if (pid < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			std::cerr << name() << ": checkpoint " << ckpt_path << " failed" << std::endl;
+		snapshot->child = 0;
+		return true;
+	}
+
+public:
+	/**
+	 * the float tables, e.g., for a learner that applies the updates of remote actors
+	 */
+	std::vector<weight>& tables() { return net; }
+
 protected:
-	std::vector<weight> net;
+	static size_t table_size(size_t length, size_t radix) {
+		size_t size = 1;
+		while (length--) size *= radix;
+		return size;
+	}
+
+protected:
+	std::shared_ptr<std::vector<weight>> model;
+	std::vector<weight>& net;
+	std::shared_ptr<std::vector<quantized>> qmodel;
+	std::vector<quantized>& qnet;
 	float alpha;
-	std::default_random_engine engine;
+	shapes tuples;
+	size_t radix;
+	feature_set features;
+
+	struct checkpoint_state {
+		std::atomic<size_t> episodes;
+		std::mutex lock;
+		pid_t child;
+		checkpoint_state() : episodes(0), child(0) {}
+	};
+	std::shared_ptr<checkpoint_state> snapshot;
+	std::string ckpt_path;
+	size_t ckpt_every;
+
+	struct replica_set {
+		std::mutex lock;
+		std::map<int, std::shared_ptr<std::vector<weight>>> tables;
+	};
+	std::shared_ptr<replica_set> replicas;
 };
 
 /**
@@ -144,36 +409,46 @@ protected:
  */
 class random_placer : public random_agent {
 public:
-	random_placer(const std::string& args = "") : random_agent("name=place role=placer " + args) {
-		spaces[0] = { 12, 13, 14, 15 };
-		spaces[1] = { 0, 4, 8, 12 };
-		spaces[2] = { 0, 1, 2, 3};
-		spaces[3] = { 3, 7, 11, 15 };
-		spaces[4] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 };
-	}
+	random_placer(const std::string& args = "") : random_agent("name=place role=placer " + args) {}
 
+	/**
+	 * place at a uniformly random empty cell of the edge opposite to the last slide
+	 * (or of the whole board before the first slide), picked from a mask of the empty cells,
+	 * and draw the tile (if there is no hint yet) and the next hint from the bag without replacement
+	 */
 	virtual action take_action(const board& after) {
-		std::vector<int> space = spaces[after.last()];
-		std::shuffle(space.begin(), space.end(), engine);
-		for (int pos : space) {
-			if (after(pos) != 0) continue;
-
-			int bag[3], num = 0;
-			for (board::cell t = 1; t <= 3; t++)
-				for (size_t i = 0; i < after.bag(t); i++)
-					bag[num++] = t;
-			std::shuffle(bag, bag + num, engine);
-
-			board::cell tile = after.hint() ?: bag[--num];
-			board::cell hint = bag[--num];
+		return choose(after);
+	}
 
-			return action::place(pos, tile, hint);
+	/**
+	 * the placement on a board or a bitboard
+	 */
+	template<class state>
+	action choose(const state& after) {
+		static const unsigned spaces[5] = { 0xf000, 0x1111, 0x000f, 0x8888, 0xffff };
+		unsigned space = spaces[after.last()], empty = 0;
+		for (unsigned mask = space; mask; mask &= mask - 1) {
+			unsigned pos = __builtin_ctz(mask);
+			if (after(pos) == 0) empty |= 1u << pos;
 		}
-		return action();
+		if (!empty) return action();
+		for (unsigned k = engine.below(__builtin_popcount(empty)); k; k--) empty &= empty - 1;
+		unsigned pos = __builtin_ctz(empty);
+
+		unsigned bag[4] = { 0, after.bag(1), after.bag(2), after.bag(3) };
+		board::cell tile = after.hint() ?: draw(bag);
+		board::cell hint = draw(bag);
+		return action::place(pos, tile, hint);
 	}
 
 private:
-	std::vector<int> spaces[5];
+	board::cell draw(unsigned* bag) {
+		unsigned k = engine.below(bag[1] + bag[2] + bag[3]);
+		board::cell t = 1;
+		while (k >= bag[t]) k -= bag[t++];
+		bag[t]--;
+		return t;
+	}
 };
 
 /**
@@ -182,20 +457,20 @@ private:
  */
 class random_slider : public random_agent {
 public:
-	random_slider(const std::string& args = "") : random_agent("name=slide role=slider " + args),
-		opcode({ 0, 1, 2, 3 }) {}
+	random_slider(const std::string& args = "") : random_agent("name=slide role=slider " + args) {}
 
+	/**
+	 * pick a uniformly random legal slide from a mask of the legal ones
+	 */
 	virtual action take_action(const board& before) {
-		std::shuffle(opcode.begin(), opcode.end(), engine);
-		for (int op : opcode) {
-			board::reward reward = board(before).slide(op);
-			if (reward != -1) return action::slide(op);
-		}
-		return action();
+		bitboard b(before);
+		unsigned legal = 0;
+		for (int op = 0; op < 4; op++)
+			if (bitboard(b).slide(op) != -1) legal |= 1u << op;
+		if (!legal) return action();
+		for (unsigned k = engine.below(__builtin_popcount(legal)); k; k--) legal &= legal - 1;
+		return action::slide(__builtin_ctz(legal));
 	}
-
-private:
-	std::array<int, 4> opcode;
 };
 
 class greedy1step_slider : public random_agent {
@@ -285,23 +560,105 @@ private:
 	std::array<int, 4> opcode;
 };
 
-class tdLearning_slider: public weight_agent {
+/**
+ * the TD learning slider of a network, whose indices of radix 16 are extracted by the unrolled
+ * code of the network; other radixes are extracted by the feature_set of its shapes
+ */
+template<class layout>
+class basic_tdLearning_slider: public weight_agent {
 public:
-	tdLearning_slider(const std::string& args = "") : weight_agent("name=slide role=slider " + args),
-	opcode({ 0, 1, 2, 3 }){}
+	typedef layout network;
+
+	basic_tdLearning_slider(const std::string& args = "") : weight_agent("name=slide role=slider " + args, tuple_shapes()),
+	opcode({ 0, 1, 2, 3 }), cache(meta.find("tt") != meta.end() ? unsigned(meta["tt"]) : 20), probes(std::make_shared<counter>()),
+	pruning(false), lower_bound(0), upper_bound(0), depth(2), budget(0), aborted(false), reference(false), split(2), deferred(false), lambda(0) {
+		if (meta.find("update") != meta.end())
+			deferred = (property("update") == "episode");
+		if (meta.find("lambda") != meta.end())
+			lambda = float(meta["lambda"]), deferred = true;
+		eval = evaluator(features, meta.find("simd") == meta.end() || int(meta["simd"]),
+			meta.find("prefetch") == meta.end() || int(meta["prefetch"]), radix == 16 ? &layout::indices : nullptr);
+		if (meta.find("search") != meta.end())
+			budget = unsigned(meta["search"]), depth = 15;
+		if (meta.find("depth") != meta.end())
+			depth = int(meta["depth"]);
+		if (meta.find("prune") != meta.end()) {
+			std::string bound = meta["prune"]; // the bounds of the values after placement, e.g., "0,100000"
+			lower_bound = std::stof(bound.substr(0, bound.find(',')));
+			upper_bound = std::stof(bound.substr(bound.find(',') + 1));
+			pruning = true;
+		}
+		if (meta.find("parallel") != meta.end() && int(meta["parallel"]) > 1)
+			workers = std::make_shared<pool>(int(meta["parallel"]));
+		if (meta.find("split") != meta.end())
+			split = int(meta["split"]);
+		if (qnet.size() && net.size()) // the float tables are kept to check the quantized moves
+			shadow = transposition(meta.find("tt") != meta.end() ? unsigned(meta["tt"]) : 20);
+	}
 
 	virtual void open_episode(const std::string& flag = "") {
         firstFlag = false;
+        cache.clear();
+        shadow.clear();
+        trace_index.clear();
+        trace_reward.clear();
     }
 
-	virtual action take_action(const board& before) {
-		auto b = board(before);
-		if (!firstFlag) prev = before;
-		int bestop = SelectBestOp(b);
+	virtual void close_episode(const std::string& flag = "") {
+		if (deferred) backward();
+		weight_agent::close_episode(flag);
+	}
+
+	/**
+	 * report the transposition table hits and misses (shared by all forks) since the last report,
+	 * the moves of the quantized tables that differ from the float tables, if both are loaded,
+	 * and with parallel=N, the speedup of the searches, i.e., their work over their wall time
+	 */
+	std::string report() {
+		std::stringstream ss;
+		ss << std::fixed << std::setprecision(1);
+		if (cache.enabled()) {
+			size_t hits = probes->hits.exchange(0), misses = probes->misses.exchange(0);
+			ss << "tt = " << (hits * 100.0 / std::max(hits + misses, size_t(1))) << "% (" << hits << "|" << misses << ")";
+		}
+		if (qnet.size() && net.size()) {
+			size_t moves = probes->moves.exchange(0), diverged = probes->diverged.exchange(0);
+			ss << (cache.enabled() ? ", " : "") << "diverge = " << diverged << "/" << moves;
+		}
+		if (workers) {
+			size_t wall = probes->wall.exchange(0), work = probes->work.exchange(0);
+			ss << (ss.tellp() ? ", " : "") << "speedup = " << std::setprecision(2) << (work / std::max(double(wall), 1.0)) << "x/" << workers->size();
+		}
+		return ss.str();
+	}
+
+	/**
+	 * whether the moves look ahead (depth= or search=), and whether the updates wait for the end of the episode
+	 */
+	bool lookahead() const { return depth || budget; }
+	bool episodic() const { return deferred; }
+
+	virtual action take_action(const board& state) {
+		PROFILE_SCOPE(profile::move);
+		bitboard before(state);
+		auto b = before;
+		if (!firstFlag) prev.board = before;
+		time_t start = workers ? stopwatch::nanosec() : 0;
+		float values[4];
+		int bestop = SelectBestOp(b, values);
+		if (qnet.size() && net.size()) CheckQuantized(b, bestop);
+		if (workers) {
+			probes->wall.fetch_add(stopwatch::nanosec() - start, std::memory_order_relaxed);
+			probes->work.fetch_add(workers->work(), std::memory_order_relaxed);
+		}
 		int bestReward = b.slide(bestop);
+		probes->hits.fetch_add(cache.hits, std::memory_order_relaxed);
+		probes->misses.fetch_add(cache.misses, std::memory_order_relaxed);
+		cache.hits = cache.misses = 0;
 
 		if (bestReward != -1) {
-			next = b;
+			next.board = b;
+			next.value = values[bestop & 0b11]; // the opcode is masked as by slide
 			train(bestReward);
 			prev = next;
 			firstFlag = true;
@@ -313,112 +670,387 @@ public:
 		}
 	}
 
-	unsigned long long int CalculateFeatureIndex(const board& before, int featureIndex) {
-		unsigned long long int value = 0;
-		auto b = board(before);
-		int size;
-		if (featureIndex > 3) size = featureSize2;
-		else size = featureSize;
+	/**
+	 * sum the weights of the extracted feature indices
+	 */
+	float CalculateFeatureValue(const size_t* index) const {
+		return eval.value(net, index);
+	}
 
-		for(int i = 0; i < size; i++){
-			value *= 20;
-			int row = feature[featureIndex][i] / 4;
-			int column = feature[featureIndex][i] % 4;
-			value +=  b[row][column];
-		}
-		return value;
+	float CalculateBoardValue(const bitboard& b) const {
+		return eval.value(net, b);
 	}
 
-	float CalculateBoardValue(const board& before) {		
-		float value = 0.0;
-		auto b = board(before);
-		for (int r = 0; r < 4; r++) {
-			b.rotate_clockwise();
-			for (int h = 0; h < 2; h++) {
-				b.reflect_horizontal();
-				for (int ind = 0; ind < featureNum; ind++) {
-					value += net[ind][CalculateFeatureIndex(b, ind)];
-				}	
-			}
-		}	
-		return value;
+	/**
+	 * evaluate with the quantized tables if loaded, unless the float reference is searched
+	 */
+	void CalculateBoardValues(const bitboard* b, size_t n, float* out) const {
+		if (qnet.size() && !reference) eval.values(qnet, b, n, out);
+		else eval.values(net, b, n, out);
+	}
+
+	/**
+	 * search the move again with the float tables (and their own transposition table),
+	 * and count whether it differs from the move of the quantized tables
+	 */
+	void CheckQuantized(const bitboard& before, int bestop) {
+		std::swap(cache, shadow);
+		reference = true;
+		int op = SelectBestOp(before);
+		reference = false;
+		std::swap(cache, shadow);
+		probes->moves.fetch_add(1, std::memory_order_relaxed);
+		probes->diverged.fetch_add(op != bestop, std::memory_order_relaxed);
 	}
 
-	int SelectBestOp(const board& before) {
+	/**
+	 * select the best move with a search of fixed depth, or, with search=<microseconds>,
+	 * deepen iteratively from depth 0 (no lookahead) until the budget of the move runs out;
+	 * the move found by the last completed depth is returned
+	 */
+	int SelectBestOp(const bitboard& before, float* values = nullptr) {
+		if (!budget) return SelectBestOp(before, depth, values);
+		deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(budget);
+		int bestop = SelectBestOp(before, 0, values);
+		for (int d = 1; d <= depth; d++) {
+			int op = SelectBestOp(before, d);
+			if (aborted) break;
+			bestop = op;
+		}
+		aborted = false;
+		return bestop;
+	}
+
+	/**
+	 * with parallel=N, the root moves are searched as tasks of the pool (without the bound
+	 * of the moves before them), and so are the outcomes of the chance nodes of depth split or more
+	 *
+	 * the values of the afterstates (without lookahead) are copied to out if given, e.g., for the update
+	 */
+	int SelectBestOp(const bitboard& before, int depth, float* out = nullptr) {
 		int bestop = -1;
 		float maxValue = -1e15;
+		bitboard after[4];
+		board::reward rewards[4];
+		float values[4];
+		Expand(before, after, rewards, values);
+		if (out) std::copy(values, values + 4, out);
+		float expects[4] = {};
+		if (workers && depth) {
+			pool::group roots;
+			for (int op : opcode) {
+				if (rewards[op] == -1) continue;
+				workers->spawn(roots, [&, op]() { expects[op] = Expectimax(after[op], op, depth); });
+			}
+			workers->wait(roots);
+		}
 		for (int op : opcode) {
-			auto after = board(before);
-			board::reward reward = after.slide(op);
-			float boardValue = CalculateBoardValue(after);
-			float expectValue = Expectimax(after, op, 2);
-			if (reward != -1) {
-				if (reward + boardValue + expectValue > maxValue) {
-					bestop = op;
-					maxValue = reward + boardValue + expectValue;
-				}
-			}	
+			board::reward reward = rewards[op];
+			if (reward == -1) continue;
+			float boardValue = values[op];
+			float expectValue = workers ? expects[op] : depth ? Expectimax(after[op], op, depth, maxValue - reward - boardValue, infinity()) : 0;
+			if (aborted) return -1;
+			if (reward + boardValue + expectValue > maxValue) {
+				bestop = op;
+				maxValue = reward + boardValue + expectValue;
+			}
 		}
 		return bestop;
 	}
 
-	float Expectimax(const board& after, int op, int depth) {
+	/**
+	 * the expected value of an afterstate, over every placement outcome:
+	 * the position is uniform over the empty cells of the edge opposite to op,
+	 * and the next hint (t) is drawn with probability bag(t) / (bag(1) + bag(2) + bag(3))
+	 *
+	 * outcomes that place the same board are expanded once; at depth 1 the next hint
+	 * is invisible to the evaluation, so only the positions are expanded
+	 *
+	 * with prune=L,U (bounds of the values after placement), the chance node is
+	 * cut by the star1 rule once the window [lower, upper] cannot be reached
+	 *
+	 * the table lines of the next outcome's afterstates are prefetched while the
+	 * current outcome is searched
+	 *
+	 * with parallel=N, the outcomes of a node of depth split or more are searched as tasks,
+	 * each cut with the star1 bounds of the others instead of their values, and summed in order
+	 */
+	float Expectimax(const bitboard& after, int op, int depth, float lower = -infinity(), float upper = infinity()) {
+		PROFILE_SCOPE(profile::search);
 		float result = 0.0;
-		int count = 0;
-		std::vector<int> pos = {0, 0, 0, 0};
-		// 0:up, 1:right, 2:down, 3:left
-		if (op == 0) pos = {12, 13, 14, 15};
-		else if (op == 1) pos = {0, 4, 8, 12};
-		else if (op == 2) pos = {0, 1, 2, 3};
-		else if (op == 3) pos = {3, 7, 11, 15};
-
-		for(int ind = 0; ind < 4; ind++){
+		if (!pruning) lower = -infinity(), upper = infinity();
+		if (cache.find(after, depth, lower, upper, result)) return result;
+		if (budget && std::chrono::steady_clock::now() > deadline) aborted = true;
+		if (aborted) return 0;
+		static const int space[4][4] = { { 12, 13, 14, 15 }, { 0, 4, 8, 12 }, { 0, 1, 2, 3 }, { 3, 7, 11, 15 } };
+		const int* pos = space[op & 0b11];
+
+		struct outcome { bitboard b; float prob; } list[12];
+		int count = 0, num = 0;
+		unsigned total = after.bag(1) + after.bag(2) + after.bag(3);
+		for (int ind = 0; ind < 4; ind++) count += (after(pos[ind]) == 0);
+		for (int ind = 0; ind < 4; ind++) {
 			if (after(pos[ind]) != 0) continue;
-			count++;
-			auto b = board(after);
-
-			int bag[3], num = 0;
-			for (board::cell t = 1; t <= 3; t++)
-				for (size_t i = 0; i < b.bag(t); i++)
-					bag[num++] = t;
-			std::shuffle(bag, bag + num, engine);
-			board::cell hint = bag[--num];
-			b.place(pos[ind], b.hint(), hint); 
-
-			float val_max = -1e15;
-			for(int i = 0; i < 4; i++){
-				auto temp = board(b);
-				int reward = temp.slide(i);
-				if(reward == -1) continue;
-				if (depth > 1) val_max = std::max(val_max, reward + CalculateBoardValue(temp) + Expectimax(temp,i,depth-1));
-				else val_max = std::max(val_max, reward + CalculateBoardValue(temp));
+			for (board::cell hint = 1; hint <= 3; hint++) {
+				if (after.bag(hint) == 0) continue;
+				auto b = after;
+				b.place(pos[ind], b.hint(), hint);
+				float prob = float(after.bag(hint)) / (total * count);
+				int k = 0;
+				while (k < num && !(list[k].b == b && (depth == 1 || list[k].b.info() == b.info()))) k++;
+				if (k == num) list[num++] = { b, 0 };
+				list[k].prob += prob;
+			}
+		}
+
+		if (workers && depth >= split && num > 1) {
+			float val_max[12];
+			pool::group outcomes;
+			for (int k = 0; k < num; k++) {
+				workers->spawn(outcomes, [&, k]() {
+					float prob = list[k].prob, rest = 1 - prob;
+					float lo = pruning ? (lower - rest * upper_bound) / prob : -infinity();
+					float hi = pruning ? (upper - rest * lower_bound) / prob : infinity();
+					val_max[k] = ExpectimaxMax(list[k].b, depth, lo, hi);
+				});
+			}
+			workers->wait(outcomes);
+			if (aborted) return 0;
+			for (int k = 0; k < num; k++) result += list[k].prob * val_max[k];
+			cache.store(after, depth, lower, upper, result);
+			return result;
+		}
+
+		float done = 0;
+		for (int k = 0; k < num; k++) {
+			float prob = list[k].prob;
+			float val_max;
+			if (k + 1 < num) PrefetchChildren(list[k + 1].b);
+			if (pruning) {
+				float rest = 1 - done - prob;
+				float lo = (lower - result - rest * upper_bound) / prob;
+				float hi = (upper - result - rest * lower_bound) / prob;
+				val_max = ExpectimaxMax(list[k].b, depth, lo, hi);
+			} else {
+				val_max = ExpectimaxMax(list[k].b, depth, -infinity(), infinity());
+			}
+			if (aborted) return 0;
+			result += prob * val_max;
+			done += prob;
+			if (pruning && k + 1 < num) {
+				if (result + (1 - done) * upper_bound <= lower) return result + (1 - done) * upper_bound;
+				if (result + (1 - done) * lower_bound >= upper) return result + (1 - done) * lower_bound;
+			}
+		}
+		cache.store(after, depth, lower, upper, result);
+		return result;
+	}
+
+	/**
+	 * the best value over the slides of a placed board, or 0 if the game is over
+	 * returns once a slide reaches upper, i.e., the chance node above cuts anyway
+	 */
+	float ExpectimaxMax(const bitboard& b, int depth, float lower, float upper) {
+		float val_max = -1e15;
+		bitboard after[4];
+		board::reward rewards[4];
+		float values[4];
+		Expand(b, after, rewards, values);
+		for (int i = 0; i < 4; i++) {
+			int reward = rewards[i];
+			if (reward == -1) continue;
+			float value = reward + values[i];
+			if (depth > 1) value += Expectimax(after[i], i, depth - 1, std::max(lower, val_max) - value, upper - value);
+			if (aborted) return 0;
+			val_max = std::max(val_max, value);
+			if (val_max >= upper) break;
+		}
+		return val_max > -1e15 ? val_max : 0;
+	}
+
+	/**
+	 * slide the board in all four directions, and evaluate the legal afterstates in one batch
+	 */
+	void Expand(const bitboard& b, bitboard* after, board::reward* rewards, float* values) const {
+		bitboard legal[4];
+		int num = 0;
+		{
+			PROFILE_SCOPE(profile::slide, 4);
+			for (int op = 0; op < 4; op++) {
+				after[op] = b;
+				rewards[op] = after[op].slide(op);
+				if (rewards[op] != -1) legal[num++] = after[op];
+			}
+		}
+		float v[4];
+		CalculateBoardValues(legal, num, v);
+		for (int op = 0, k = 0; op < 4; op++) values[op] = rewards[op] != -1 ? v[k++] : 0;
+	}
+
+	void PrefetchChildren(const bitboard& b) const {
+		bitboard after[4];
+		int num = 0;
+		{
+			PROFILE_SCOPE(profile::slide, 4);
+			for (int op = 0; op < 4; op++) {
+				after[num] = b;
+				if (after[num].slide(op) != -1) num++;
 			}
-			if (val_max > -1e15) result += val_max;
 		}
-		return result/count;
+		if (qnet.size() && !reference) eval.prefetch(qnet, after, num);
+		else eval.prefetch(net, after, num);
 	}
 
+	static float infinity() { return std::numeric_limits<float>::infinity(); }
+
+	/**
+	 * the indices of prev are carried from the move that selected it (except for the board
+	 * before the first slide), and the value of next is the one of the search, so each move
+	 * extracts the indices of next alone, and evaluates prev alone (after the last update)
+	 */
 	void train(int reward) {
+		if (alpha == 0) return; // tables may be mapped read-only
+		if (!firstFlag) extract(prev.board, prev.index);
+		if (reward != -1) extract(next.board, next.index);
+		if (deferred) return record(reward);
+		update(prev.index, reward, reward != -1 ? next.value : 0);
+	}
+
+	/**
+	 * the TD(0) update of an afterstate toward the reward and the value of the next afterstate,
+	 * or toward 0 if the episode has ended (reward -1)
+	 */
+	void update(const bitboard& before, int reward, float forward) {
+		if (alpha == 0) return;
+		size_t index[layout::count];
+		extract(before, index);
+		update(index, reward, forward);
+	}
+	void update(const size_t* index, int reward, float forward) {
+		PROFILE_SCOPE(profile::update, features.count());
 		double vupdate;
 		if (reward == -1) {
-			vupdate = alpha * (-CalculateBoardValue(prev));
+			vupdate = alpha * (-CalculateFeatureValue(index));
 		}
 		else {
-			vupdate = alpha * (CalculateBoardValue(next) - CalculateBoardValue(prev) + reward);
-		}
-		for (int r = 0; r < 4; r++) {
-			prev.rotate_clockwise();
-			for (int h = 0; h < 2; h++) {
-				prev.reflect_horizontal();
-				for (int ind = 0; ind < featureNum; ind++) {
-					net[ind][CalculateFeatureIndex(prev, ind)] += vupdate;
-				}	
+			vupdate = alpha * (forward - CalculateFeatureValue(index) + reward);
+		}
+		for (size_t i = 0; i < features.count(); i++) {
+			net[i % layout::size].update(index[i], vupdate);
+		}
+		if (publish) publish(index, features.count(), vupdate);
+	}
+
+	/**
+	 * with update=episode, the afterstates are recorded (prev first, then next with its reward
+	 * on every move), and the whole episode is trained by one backward pass in close_episode
+	 */
+	void record(int reward) {
+		if (trace_index.empty())
+			trace_index.insert(trace_index.end(), prev.index, prev.index + features.count());
+		if (reward != -1) {
+			trace_index.insert(trace_index.end(), next.index, next.index + features.count());
+			trace_reward.push_back(reward);
+		}
+	}
+
+	/**
+	 * train the recorded afterstates from the last one backward with TD(lambda): the target of
+	 * state (t) is r(t+1) + (1 - lambda) V(t+1) + lambda G(t+1), where V(t+1) is re-evaluated after its own
+	 * update, and the last afterstate is trained toward 0; lambda=0 is TD(0) with a deferred pass
+	 *
+	 * the table lines of the preceding state are prefetched while the current one is updated
+	 */
+	void backward() {
+		size_t n = features.count(), last = trace_reward.size();
+		if (trace_index.empty()) return;
+		PROFILE_SCOPE(profile::update, trace_index.size());
+		float target = 0, forward = 0;
+		for (size_t t = last + 1; t-- > 0; ) {
+			const size_t* index = trace_index.data() + t * n;
+			if (t) PrefetchFeatureValue(index - n);
+			if (t < last) target = trace_reward[t] + (1 - lambda) * forward + lambda * target;
+			double vupdate = alpha * (target - CalculateFeatureValue(index));
+			for (size_t i = 0; i < n; i++) {
+				net[i % layout::size].update(index[i], vupdate);
 			}
-		}	
+			if (publish) publish(index, n, vupdate);
+			forward = CalculateFeatureValue(index);
+		}
+		trace_index.clear();
+		trace_reward.clear();
+	}
+
+	void extract(const bitboard& b, size_t* index) const {
+		if (radix == 16) layout::indices(b, index);
+		else features.indices(b, index);
+	}
+
+	void PrefetchFeatureValue(const size_t* index) const {
+		for (size_t i = 0; i < features.count(); i++) {
+			__builtin_prefetch(&net[i % layout::size][index[i]], 1);
+		}
 	}
 
 private:
 	std::array<int, 4> opcode;
 	bool firstFlag = false;
-	board prev, next;
-};
\ No newline at end of file
+
+	/**
+	 * an afterstate of the slider, with its value when it was selected and its feature indices
+	 */
+	struct afterstate {
+		bitboard board;
+		float value = 0;
+		size_t index[layout::count];
+	};
+	afterstate prev, next;
+	transposition cache;
+	transposition shadow; // the cache of the float tables while checking the quantized moves
+
+	struct counter {
+		std::atomic<size_t> hits, misses;
+		std::atomic<size_t> moves, diverged;
+		std::atomic<size_t> wall, work; // the nanoseconds of the parallel searches
+		counter() : hits(0), misses(0), moves(0), diverged(0), wall(0), work(0) {}
+	};
+	std::shared_ptr<counter> probes;
+
+	bool pruning;
+	float lower_bound, upper_bound;
+
+	int depth; // the fixed depth, or the maximum depth of iterative deepening
+	unsigned budget; // the time budget of a move in microseconds, or 0 for the fixed depth
+	std::chrono::steady_clock::time_point deadline;
+	relaxed<bool> aborted; // set by any task of a parallel search
+	bool reference; // search with the float tables instead of the quantized ones
+
+	std::shared_ptr<pool> workers; // the pool of parallel=N, shared by the forks
+	int split; // the minimum depth of the chance nodes searched in parallel
+
+	evaluator eval;
+
+	bool deferred; // train in close_episode instead of on every move
+	float lambda;
+	std::vector<size_t> trace_index;
+	std::vector<int> trace_reward;
+
+public:
+	/**
+	 * called with the indices and the delta of every update, e.g., to send them to a remote learner
+	 */
+	std::function<void(const size_t* index, size_t n, float delta)> publish;
+
+public:
+	static shapes tuple_shapes() {
+		return layout::shapes();
+	}
+};
+
+/**
+ * the network of the slider, e.g., build with -DNETWORK=four_tuples for the 8x4-tuple network
+ */
+#ifndef NETWORK
+#define NETWORK six_tuples
+#endif
+typedef basic_tdLearning_slider<NETWORK> tdLearning_slider;
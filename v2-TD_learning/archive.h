@@ -0,0 +1,190 @@
+/**
+ * Framework for Threes! and its variants (C++ 11)
+ * archive.h: Versioned, memory-mappable file format of weight tables
+ *
+ * Author: Theory of Computer Games
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <vector>
+#include <string>
+#include <fstream>
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "weight.h"
+
+/**
+ * a weight file with a header, one descriptor per table, and page-aligned tables
+ *
+ * header (32 bytes): magic "THREESNT", version, count, radix, alignment, element size, reserved
+ * descriptor (32 bytes): tuple length, tuple cells (up to 8), scale, table size, table offset
+ * all fields are stored in the native (little-endian) byte order
+ *
+ * the element size is 4 for float tables (see weight), or 2 for 16-bit tables whose
+ * entries are multiplied by the scale of their descriptor (see quantized)
+ *
+ * since every table is aligned to pages, the tables can be used directly from a
+ * memory mapping of the file: read-only mappings of many processes share one copy
+ * of the file in the page cache, and a private writable mapping is copy-on-write
+ */
+class archive {
+public:
+	typedef std::vector<std::vector<unsigned>> shapes;
+	static const uint32_t version = 1;
+
+	struct header {
+		char magic[8];
+		uint32_t version;
+		uint32_t count;
+		uint32_t radix;
+		uint32_t alignment;
+		uint32_t element;
+		uint32_t reserved;
+	};
+	struct descriptor {
+		uint32_t length;
+		uint8_t cells[8];
+		float scale;
+		uint64_t size;
+		uint64_t offset;
+	};
+
+public:
+	/**
+	 * check whether the file starts with the magic of this format
+	 */
+	static bool detect(const std::string& path) {
+		char magic[8] = {};
+		std::ifstream in(path, std::ios::in | std::ios::binary);
+		in.read(magic, sizeof(magic));
+		return in && std::memcmp(magic, signature(), sizeof(magic)) == 0;
+	}
+
+	/**
+	 * the element size of the tables in an archive, or 0 if it cannot be read
+	 */
+	static uint32_t element(const std::string& path) {
+		header head = {};
+		std::ifstream in(path, std::ios::in | std::ios::binary);
+		in.read(reinterpret_cast<char*>(&head), sizeof(head));
+		return in ? head.element : 0;
+	}
+
+	template<class table>
+	static void save(const std::string& path, const std::vector<table>& net, const shapes& tuples,
+			uint32_t radix, uint32_t alignment = 4096) {
+		typedef typename table::type type;
+		if (tuples.size() != net.size()) throw std::invalid_argument("archive: tuple shapes do not match tables");
+		header head = {};
+		std::memcpy(head.magic, signature(), sizeof(head.magic));
+		head.version = version;
+		head.count = net.size();
+		head.radix = radix;
+		head.alignment = alignment;
+		head.element = sizeof(type);
+
+		std::vector<descriptor> desc(net.size());
+		uint64_t offset = align(sizeof(header) + sizeof(descriptor) * desc.size(), alignment);
+		for (size_t i = 0; i < net.size(); i++) {
+			desc[i] = {};
+			desc[i].length = tuples[i].size();
+			for (size_t j = 0; j < tuples[i].size() && j < 8; j++) desc[i].cells[j] = tuples[i][j];
+			desc[i].scale = scale(net[i]);
+			desc[i].size = net[i].size();
+			desc[i].offset = offset;
+			offset = align(offset + (desc[i].size + spare(sizeof(type))) * sizeof(type), alignment);
+		}
+
+		std::ofstream out(path, std::ios::out | std::ios::binary | std::ios::trunc);
+		if (!out.is_open()) throw std::runtime_error("archive: cannot open " + path);
+		out.write(reinterpret_cast<const char*>(&head), sizeof(head));
+		out.write(reinterpret_cast<const char*>(desc.data()), sizeof(descriptor) * desc.size());
+		for (size_t i = 0; i < net.size(); i++) {
+			pad(out, desc[i].offset);
+			out.write(reinterpret_cast<const char*>(net[i].data()), sizeof(type) * net[i].size());
+		}
+		pad(out, offset);
+		if (!out) throw std::runtime_error("archive: cannot write " + path);
+	}
+
+	/**
+	 * map the tables of the file, and return the tuple shapes and the radix stored in it
+	 * the tables are read-only unless writable, in which case writes are private to the process
+	 */
+	template<class table>
+	static std::vector<table> map(const std::string& path, shapes& tuples, uint32_t& radix, bool writable = false) {
+		typedef typename table::type type;
+		int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0) throw std::runtime_error("archive: cannot open " + path);
+		struct stat st;
+		if (::fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(header)) {
+			::close(fd);
+			throw std::runtime_error("archive: cannot read " + path);
+		}
+		size_t length = st.st_size;
+		void* base = ::mmap(nullptr, length, PROT_READ | (writable ? PROT_WRITE : 0), MAP_PRIVATE, fd, 0);
+		::close(fd);
+		if (base == MAP_FAILED) throw std::runtime_error("archive: cannot map " + path);
+		std::shared_ptr<void> owner(base, [length](void* p) { ::munmap(p, length); });
+		::madvise(base, length, MADV_RANDOM);
+
+		const char* file = static_cast<const char*>(base);
+		const header& head = *reinterpret_cast<const header*>(file);
+		if (std::memcmp(head.magic, signature(), sizeof(head.magic)) != 0)
+			throw std::runtime_error("archive: " + path + " is not a weight archive");
+		if (head.version != version)
+			throw std::runtime_error("archive: " + path + " has unsupported version " + std::to_string(head.version));
+		if (head.element != sizeof(type))
+			throw std::runtime_error("archive: " + path + " has unsupported element size " + std::to_string(head.element));
+		if (head.alignment == 0 || (head.alignment & (head.alignment - 1)))
+			throw std::runtime_error("archive: " + path + " has an invalid alignment " + std::to_string(head.alignment));
+		if (head.count > (length - sizeof(header)) / sizeof(descriptor))
+			throw std::runtime_error("archive: " + path + " is truncated");
+
+		const descriptor* desc = reinterpret_cast<const descriptor*>(file + sizeof(header));
+		std::vector<table> net;
+		tuples.clear();
+		for (size_t i = 0; i < head.count; i++) {
+			const descriptor& d = desc[i];
+			// the entries (and the spare ones) must fit after the offset, checked without overflow
+			uint64_t room = d.offset <= length ? (length - d.offset) / sizeof(type) : 0;
+			if (d.length > 8 || d.offset % head.alignment || d.offset > length || room < spare(sizeof(type)) || d.size > room - spare(sizeof(type)))
+				throw std::runtime_error("archive: " + path + " has a corrupted table " + std::to_string(i));
+			tuples.emplace_back(d.cells, d.cells + d.length);
+			type* data = reinterpret_cast<type*>(static_cast<char*>(base) + d.offset);
+			net.push_back(attach(data, d.size, d.scale, owner));
+		}
+		radix = head.radix;
+		return net;
+	}
+
+private:
+	static const char* signature() { return "THREESNT"; }
+	static float scale(const weight&) { return 1; }
+	static float scale(const quantized& w) { return w.scale(); }
+	static weight attach(weight::type* data, size_t size, float, const std::shared_ptr<void>& owner) {
+		return weight(data, size, owner);
+	}
+	static quantized attach(quantized::type* data, size_t size, float scale, const std::shared_ptr<void>& owner) {
+		return quantized(data, size, scale, owner);
+	}
+	/**
+	 * the entries padded after a table of narrow entries, which are gathered as 32-bit words
+	 */
+	static uint64_t spare(size_t element) { return element < 4 ? 1 : 0; }
+	static uint64_t align(uint64_t offset, uint64_t alignment) {
+		return (offset + alignment - 1) / alignment * alignment;
+	}
+	static void pad(std::ostream& out, uint64_t offset) {
+		static const char zero[4096] = {};
+		for (uint64_t at = out.tellp(); at < offset; at = out.tellp())
+			out.write(zero, std::min<uint64_t>(offset - at, sizeof(zero)));
+	}
+};
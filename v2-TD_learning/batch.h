@@ -0,0 +1,184 @@
+/**
+ * Framework for Threes! and its variants (C++ 11)
+ * batch.h: Lockstep simulation of many games for a slider without lookahead
+ *
+ * Author: Theory of Computer Games
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdlib>
+#include "board.h"
+#include "bitboard.h"
+#include "action.h"
+#include "agent.h"
+#include "episode.h"
+#include "statistics.h"
+#include "stopwatch.h"
+
+/**
+ * K games played in lockstep by a slider of depth=0: on every turn, the games that slide
+ * expand their four afterstates, and the legal afterstates of all the games are evaluated
+ * by one call of the slider, so the evaluator works on long batches (with its prefetch)
+ * instead of four boards at a time
+ *
+ * the boards of the slots are kept as an array of their tiles and an array of their info,
+ * and a slot whose game ends is refilled by the next game, so the slots stay busy
+ *
+ * the placer of game g is seeded by (seed, g) as with --evaluate, so the games do not
+ * depend on K, and equal those of --evaluate; if the slider learns, it is trained by TD(0)
+ * on every move, but the moves of a turn are all selected before the updates of the turn
+ *
+ * the placements are timed one by one, and the time of the batch (with its updates) is split over the slides
+ * of the turn; the time of a game is the sum of the times of its moves, since its wall time spans the other
+ * games of the slots, and the throughput of the whole batch is shown at the end of the run
+ */
+class lockstep {
+public:
+	lockstep(size_t width, tdLearning_slider& slide, const std::string& place_args, unsigned seed) :
+		slide(slide), seed(seed), width(std::max<size_t>(width, 1)),
+		tiles(this->width), info(this->width), prev(this->width), game(this->width), started(this->width), games(this->width),
+		after(4 * this->width), legal(4 * this->width), rewards(4 * this->width), values(4 * this->width), chosen(this->width) {
+		if (slide.lookahead() || slide.episodic()) {
+			std::cerr << "batch: the slider must play with depth=0 and learn on every move" << std::endl;
+			std::exit(-1);
+		}
+		for (size_t s = 0; s < this->width; s++) placers.emplace_back(place_args);
+	}
+
+	/**
+	 * play the games first .. first + count - 1, and append them to stats in game order
+	 */
+	void run(statistics& stats, size_t first, size_t count) {
+		size_t issued = 0, active = 0, moves = 0;
+		time_t wall = stopwatch::nanosec();
+		std::map<size_t, episode> pending; // the finished games that wait for the earlier ones
+		size_t merged = first;
+		auto refill = [&](size_t s) {
+			if (issued < count) begin(s, first + issued++), active++;
+			else game[s] = none;
+		};
+		auto finish = [&](size_t s, const std::string& tag) {
+			end(s, tag);
+			moves += games[s].step();
+			pending.emplace(game[s], std::move(games[s]));
+			for (auto it = pending.begin(); it != pending.end() && it->first == merged; it = pending.erase(it), merged++)
+				stats.append(std::move(it->second));
+			active--;
+			refill(s);
+		};
+		for (size_t s = 0; s < width; s++) refill(s);
+
+		std::vector<size_t> sliding;
+		while (active) {
+			sliding.clear();
+			for (size_t s = 0; s < width; s++) {
+				if (game[s] == none) continue;
+				size_t step = games[s].step();
+				if (step >= 9 && (step - 9) % 2 == 0) {
+					sliding.push_back(s);
+					continue;
+				}
+				time_t start = stopwatch::nanosec();
+				bitboard b(tiles[s], info[s]);
+				action move = placers[s].choose(b);
+				action::place pl(move);
+				board::reward reward = move.type() == action::place::type ? b.place(pl.position(), pl.tile(), pl.hint()) : -1;
+				if (reward == -1) {
+					finish(s, step < 9 ? placers[s].name() : slide.name());
+					continue;
+				}
+				tiles[s] = b.bits(), info[s] = b.info();
+				games[s].record(move, reward, stopwatch::nanosec() - start);
+			}
+			if (sliding.empty()) continue;
+
+			time_t start = stopwatch::nanosec();
+			size_t n = 0;
+			for (size_t k = 0; k < sliding.size(); k++) {
+				bitboard b(tiles[sliding[k]], info[sliding[k]]);
+				for (int op = 0; op < 4; op++) {
+					after[4 * k + op] = b;
+					rewards[4 * k + op] = after[4 * k + op].slide(op);
+					if (rewards[4 * k + op] != -1) legal[n++] = after[4 * k + op];
+				}
+			}
+			slide.CalculateBoardValues(legal.data(), n, values.data());
+
+			for (size_t k = 0, v = 0; k < sliding.size(); k++) {
+				size_t s = sliding[k];
+				int bestop = -1;
+				float maxValue = -1e15, bestValue = 0;
+				for (int op = 0; op < 4; op++) { // the same rule as SelectBestOp at depth 0
+					board::reward reward = rewards[4 * k + op];
+					if (reward == -1) continue;
+					float value = values[v++];
+					if (reward + value > maxValue) bestop = op, maxValue = reward + value, bestValue = value;
+				}
+				if (!started[s]) prev[s] = bitboard(tiles[s], info[s]);
+				chosen[k] = bestop;
+				if (bestop == -1) {
+					slide.update(prev[s], -1, 0);
+					continue;
+				}
+				const bitboard& next = after[4 * k + bestop];
+				slide.update(prev[s], rewards[4 * k + bestop], bestValue);
+				prev[s] = next, started[s] = true;
+				tiles[s] = next.bits(), info[s] = next.info();
+			}
+			time_t share = (stopwatch::nanosec() - start) / sliding.size(); // the batch and its updates are shared by the slides of the turn
+
+			for (size_t k = 0; k < sliding.size(); k++) {
+				size_t s = sliding[k];
+				if (chosen[k] == -1) finish(s, placers[s].name());
+				else games[s].record(action::slide(chosen[k]), rewards[4 * k + chosen[k]], share);
+			}
+		}
+		wall = stopwatch::nanosec() - wall;
+		if (count) std::cerr << "batch: " << count << " games, " << moves << " moves in " << (wall / 1e9) << " s, ops = " << size_t(moves * 1e9 / (wall ?: 1)) << std::endl;
+	}
+
+private:
+	void begin(size_t s, size_t g) {
+		game[s] = g;
+		games[s] = episode();
+		bitboard b(games[s].state());
+		tiles[s] = b.bits(), info[s] = b.info();
+		started[s] = false;
+		placers[s].seed(random_agent::seed(seed, g));
+		games[s].open_episode(slide.name() + ":" + placers[s].name());
+	}
+
+	void end(size_t s, const std::string& tag) {
+		games[s].state() = bitboard(tiles[s], info[s]);
+		games[s].close_episode(tag, games[s].time(action::place::type) + games[s].time(action::slide::type));
+		slide.close_episode(tag); // e.g., for the checkpoints
+		placers[s].close_episode(tag);
+	}
+
+private:
+	static const size_t none = size_t(-1);
+
+	tdLearning_slider& slide;
+	unsigned seed;
+	size_t width;
+	std::vector<random_placer> placers;
+
+	std::vector<bitboard::raw> tiles; // the boards of the slots, as structure of arrays
+	std::vector<bitboard::data> info;
+	std::vector<bitboard> prev; // the last afterstate of the slider in each slot
+	std::vector<size_t> game; // the game id of each slot, or none
+	std::vector<bool> started; // whether the slider has moved in the game
+	std::vector<episode> games;
+
+	std::vector<bitboard> after; // the four afterstates of each sliding slot, staged for the evaluator
+	std::vector<bitboard> legal;
+	std::vector<board::reward> rewards;
+	std::vector<float> values;
+	std::vector<int> chosen; // the move of each sliding slot, or -1 if its game ends
+};
@@ -0,0 +1,306 @@
+/**
+ * Framework for Threes! and its variants (C++ 11)
+ * bench.cpp: Microbenchmarks of the board, action, and agent kernels
+ *
+ * Author: Theory of Computer Games
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <iterator>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <random>
+#include <chrono>
+#include "board.h"
+#include "action.h"
+#include "agent.h"
+#include "episode.h"
+#include "statistics.h"
+#include "evaluator.h"
+
+/**
+ * a board of the corpus: the state before a slide, the recorded slide, the state
+ * after the slide, and the recorded placement that followed it
+ */
+struct sample {
+	board before;
+	action slide;
+	board after;
+	action place;
+};
+
+/**
+ * collect the samples of fixed-seed random games
+ */
+std::vector<sample> collect(size_t count, unsigned seed) {
+	std::vector<sample> corpus;
+	random_slider slide("seed=" + std::to_string(seed));
+	random_placer place("seed=" + std::to_string(seed + 1));
+	while (corpus.size() < count) {
+		episode game;
+		game.open_episode(slide.name() + ":" + place.name());
+		sample rec;
+		bool pending = false;
+		while (corpus.size() < count) {
+			agent& who = game.take_turns(slide, place);
+			action move = who.take_action(game.state());
+			board state = game.state();
+			if (game.apply_action(move) != true) break;
+			if (&who == &slide) {
+				rec = { state, move, game.state(), action() };
+				pending = true;
+			} else if (pending) {
+				rec.place = move;
+				corpus.push_back(rec);
+				pending = false;
+			}
+		}
+	}
+	return corpus;
+}
+
+/**
+ * replay the episodes of a statistics log (text or binary), and collect the samples of
+ * their middle halves, i.e., real mid-game boards of the agent that played them
+ */
+std::vector<sample> replay(const std::string& path, size_t count) {
+	statistics stats(0);
+	std::ifstream in(path, std::ios::in | std::ios::binary);
+	if (!in.is_open()) {
+		std::cerr << "bench: cannot open " << path << std::endl;
+		std::exit(-1);
+	}
+	in >> stats;
+	std::vector<sample> corpus;
+	for (size_t i = 0; i < stats.step() && corpus.size() < count; i++) {
+		std::vector<action> moves = stats.at(i).actions();
+		std::vector<sample> game;
+		board state;
+		for (size_t k = 0; k < moves.size(); k++) {
+			board before = state;
+			if (moves[k].apply(state) == -1) break;
+			if (moves[k].type() == action::slide::type && k + 1 < moves.size())
+				game.push_back({ before, moves[k], state, moves[k + 1] });
+		}
+		for (size_t k = game.size() / 4; k < game.size() * 3 / 4 && corpus.size() < count; k++) corpus.push_back(game[k]);
+	}
+	return corpus;
+}
+
+/**
+ * time the kernels, report ns/op and ops/s, and compare them against a saved baseline
+ */
+class suite {
+public:
+	suite(size_t rounds, double tolerance) : rounds(rounds), tolerance(tolerance), regressions(0) {}
+
+	/**
+	 * time kernel(), which performs ops operations per call, over the rounds after a warm-up call
+	 */
+	template<class kernel>
+	void run(const std::string& name, size_t ops, kernel work, size_t times = 0) {
+		times = times ?: rounds;
+		work();
+		auto start = std::chrono::steady_clock::now();
+		for (size_t r = 0; r < times; r++) work();
+		auto elapsed = std::chrono::steady_clock::now() - start;
+		double ns = std::chrono::duration<double, std::nano>(elapsed).count() / (times * std::max<size_t>(ops, 1));
+		results.emplace_back(name, ns);
+
+		std::ios ff(nullptr);
+		ff.copyfmt(std::cout);
+		std::cout << std::fixed << std::setprecision(1);
+		std::cout << std::left << std::setw(40) << name << std::right;
+		std::cout << std::setw(12) << ns << " ns/op" << std::setw(14) << std::setprecision(0) << (1e9 / ns) << " ops/s";
+		auto base = baseline.find(name);
+		if (base != baseline.end()) {
+			double delta = (ns / base->second - 1) * 100;
+			std::cout << std::setw(10) << std::setprecision(1) << std::showpos << delta << "%" << std::noshowpos;
+			if (delta > tolerance) std::cout << "  <- regression", regressions++;
+		}
+		std::cout << std::endl;
+		std::cout.copyfmt(ff);
+	}
+
+	/**
+	 * the baseline file has one "name ns" line per kernel, as written by save()
+	 */
+	void load(const std::string& path) {
+		std::ifstream in(path);
+		if (!in.is_open()) {
+			std::cerr << "bench: cannot open " << path << std::endl;
+			std::exit(-1);
+		}
+		std::string name;
+		for (double ns; in >> name >> ns; ) baseline[name] = ns;
+	}
+	void save(const std::string& path) const {
+		std::ofstream out(path, std::ios::out | std::ios::trunc);
+		for (const auto& res : results) out << res.first << " " << res.second << std::endl;
+	}
+
+	size_t failed() const { return regressions; }
+
+private:
+	size_t rounds;
+	double tolerance; // the slowdown in percent counted as a regression
+	size_t regressions;
+	std::vector<std::pair<std::string, double>> results;
+	std::map<std::string, double> baseline;
+};
+
+int main(int argc, const char* argv[]) {
+	std::cout << "Threes! Bench: ";
+	std::copy(argv, argv + argc, std::ostream_iterator<const char*>(std::cout, " "));
+	std::cout << std::endl << std::endl;
+
+	size_t radix = 16, count = 1 << 16, rounds = 10, moves = 2000;
+	unsigned seed = 0;
+	double tolerance = 10;
+	std::string corpus_path, baseline_path, save_path, slide_args;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		auto match_arg = [&](std::string flag) -> bool {
+			auto it = arg.find_first_not_of('-');
+			return arg.find(flag, it) == it;
+		};
+		auto next_opt = [&]() -> std::string {
+			auto it = arg.find('=') + 1;
+			return it ? arg.substr(it) : argv[++i];
+		};
+		if (match_arg("radix")) {
+			radix = std::stoull(next_opt());
+		} else if (match_arg("boards")) {
+			count = std::stoull(next_opt());
+		} else if (match_arg("rounds")) {
+			rounds = std::stoull(next_opt());
+		} else if (match_arg("moves")) {
+			moves = std::stoull(next_opt());
+		} else if (match_arg("seed")) {
+			seed = std::stoul(next_opt());
+		} else if (match_arg("corpus")) {
+			corpus_path = next_opt();
+		} else if (match_arg("baseline")) {
+			baseline_path = next_opt();
+		} else if (match_arg("save")) {
+			save_path = next_opt();
+		} else if (match_arg("tolerance")) {
+			tolerance = std::stod(next_opt());
+		} else if (match_arg("slide")) {
+			slide_args = next_opt();
+		}
+	}
+
+	// the corpus is the mid-game boards of a recorded log, by default the stats.txt of make stats;
+	// without any log, the boards of fixed-seed random games are taken instead, whose states are younger
+	if (corpus_path.empty() && std::ifstream("stats.txt").is_open()) corpus_path = "stats.txt";
+	std::vector<sample> corpus = corpus_path.size() ? replay(corpus_path, count) : collect(count, seed);
+	if (corpus.empty()) {
+		std::cerr << "bench: the corpus is empty" << std::endl;
+		return -1;
+	}
+	std::vector<bitboard> boards;
+	for (const sample& s : corpus) boards.emplace_back(s.before);
+	std::cout << "corpus = " << corpus.size() << " boards" << (corpus_path.size() ? " from " + corpus_path : " of random games (no stats.txt, see make stats)") << std::endl;
+	std::cout << std::endl;
+
+	suite bench(rounds, tolerance);
+	if (baseline_path.size()) bench.load(baseline_path);
+	volatile board::reward sink = 0;
+	float fsink = 0;
+
+	bench.run("board::slide_left", corpus.size(), [&]() {
+		for (const sample& s : corpus) sink += board(s.before).slide_left();
+	});
+	bench.run("board::slide", corpus.size(), [&]() {
+		for (const sample& s : corpus) sink += board(s.before).slide(action(s.slide).event());
+	});
+	bench.run("board::place", corpus.size(), [&]() {
+		for (const sample& s : corpus) {
+			action::place p(s.place);
+			sink += board(s.after).place(p.position(), p.tile(), p.hint());
+		}
+	});
+	bench.run("bitboard::slide_left", boards.size(), [&]() {
+		for (const bitboard& b : boards) sink += bitboard(b).slide_left();
+	});
+	bench.run("bitboard::slide", corpus.size(), [&]() {
+		for (size_t k = 0; k < corpus.size(); k++) sink += bitboard(boards[k]).slide(corpus[k].slide.event());
+	});
+	bench.run("action::apply/slide", corpus.size(), [&]() {
+		for (const sample& s : corpus) {
+			board b = s.before;
+			sink += s.slide.apply(b);
+		}
+	});
+	bench.run("action::apply/place", corpus.size(), [&]() {
+		for (const sample& s : corpus) {
+			board b = s.after;
+			sink += s.place.apply(b);
+		}
+	});
+	random_placer place("seed=" + std::to_string(seed));
+	bench.run("random_placer::take_action", corpus.size(), [&]() {
+		for (const sample& s : corpus) sink += place.take_action(s.after).event();
+	});
+
+	feature_set features(tdLearning_slider::tuple_shapes(), radix);
+	std::vector<weight> net;
+	std::default_random_engine engine(seed);
+	std::uniform_real_distribution<float> dist(-1, 1);
+	for (size_t p = 0; p < features.size(); p++) {
+		net.emplace_back(features[p].size());
+		for (size_t i = 0; i < net.back().size(); i++) net.back()[i] = dist(engine);
+	}
+	std::vector<quantized> qnet(net.begin(), net.end());
+	size_t index[tdLearning_slider::network::count];
+	bench.run("feature_set::indices", boards.size(), [&]() {
+		for (const bitboard& b : boards) features.indices(b, index), sink += index[0];
+	});
+	if (radix == 16) {
+		bench.run("network::indices", boards.size(), [&]() {
+			for (const bitboard& b : boards) tdLearning_slider::network::indices(b, index), sink += index[0];
+		});
+	}
+	for (bool simd : { false, true }) {
+		for (size_t n : { 1, 4 }) {
+			for (bool prefetch : { false, true }) {
+				evaluator eval(features, simd, prefetch, radix == 16 ? &tdLearning_slider::network::indices : nullptr);
+				if (simd && !eval.vectorized()) break;
+				std::stringstream name;
+				name << "evaluator/" << (simd ? "avx2" : "scalar") << "/batch=" << n << "/prefetch=" << prefetch;
+				float v[4];
+				size_t ops = boards.size() / n * n;
+				bench.run(name.str() + "/float", ops, [&]() {
+					for (size_t k = 0; k + n <= boards.size(); k += n) eval.values(net, &boards[k], n, v), fsink += v[0];
+				});
+				bench.run(name.str() + "/int16", ops, [&]() {
+					for (size_t k = 0; k + n <= boards.size(); k += n) eval.values(qnet, &boards[k], n, v), fsink += v[0];
+				});
+			}
+		}
+	}
+	net.clear();
+	qnet.clear();
+
+	tdLearning_slider slide(slide_args.size() ? slide_args : "init alpha=0 radix=" + std::to_string(radix));
+	size_t searched = std::min(moves, boards.size());
+	bench.run("tdLearning_slider::SelectBestOp", searched, [&]() {
+		slide.open_episode(); // a new generation of the transposition table
+		for (size_t k = 0; k < searched; k++) sink += slide.SelectBestOp(boards[k]);
+	}, 1);
+
+	std::cerr << "checksum = " << (sink + fsink) << std::endl;
+	if (save_path.size()) bench.save(save_path);
+	if (bench.failed()) {
+		std::cout << std::endl << bench.failed() << " kernels regressed by more than " << tolerance << "%" << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,242 @@
+/**
+ * Framework for Threes! and its variants (C++ 11)
+ * bitboard.h: Define the packed game state with table-driven operations
+ *
+ * Author: Theory of Computer Games
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <array>
+#include <iostream>
+#include <cstdint>
+#include "board.h"
+
+/**
+ * 64-bit packed board for Threes!
+ *
+ * each cell takes 4 bits, the cell (i) is stored at bits [4i, 4i + 4),
+ * i.e., each row is a 16-bit word with its leftmost cell in the lowest nibble
+ *
+ * the interface is the same as board (place, slide, hint, last, bag, ...),
+ * and a bitboard converts implicitly from and to a board
+ */
+class bitboard {
+public:
+	typedef board::cell cell;
+	typedef uint64_t raw;
+	typedef board::data data;
+	typedef board::score score;
+	typedef board::reward reward;
+
+public:
+	bitboard() : tile(0), attr(0) { reset(); }
+	bitboard(raw t, data v = 0) : tile(t), attr(v) {}
+	bitboard(const board& b) : tile(0), attr(b.info()) {
+		for (unsigned i = 0; i < 16; i++) tile |= raw(b(i) & 0x0fu) << (4 * i);
+	}
+	bitboard(const bitboard& b) = default;
+	bitboard& operator =(const bitboard& b) = default;
+
+	operator board() const {
+		board b({}, attr);
+		for (unsigned i = 0; i < 16; i++) b(i) = operator()(i);
+		return b;
+	}
+	cell operator ()(unsigned i) const { return (tile >> (4 * i)) & 0x0fu; }
+	void set(unsigned i, cell t) { tile = (tile & ~(raw(0x0fu) << (4 * i))) | (raw(t & 0x0fu) << (4 * i)); }
+
+	raw bits() const { return tile; }
+	raw bits(raw t) { raw old = tile; tile = t; return old; }
+	data info() const { return attr; }
+	data info(data dat) { data old = attr; attr = dat; return old; }
+
+private:
+	data info4(size_t i) const { return (info() >> (4 * i)) & 0x0fu; }
+	data info4(size_t i, data dat) { data old = info4(i); info(info() ^ ((old ^ dat) << (4 * i))); return old; }
+
+public:
+	cell hint() const { return info4(0); }
+	cell hint(cell t) { return info4(0, t); }
+	unsigned last() const { return info4(1); }
+	unsigned last(unsigned a) { return info4(1, a); }
+	unsigned bag(cell t) const { return info4(t + 1); }
+	unsigned bag(cell t, unsigned n) { return info4(t + 1, n); }
+
+	void reset() {
+		hint(0);
+		last(4);
+		reset_bag();
+	}
+	void reset_bag() {
+		for (cell t = 1; t <= 3; t++) bag(t, 1);
+	}
+	bool extract_hint_from_bag(cell t) {
+		if (bag(t) < 1) return false;
+		bag(t, bag(t) - 1);
+		if (bag(1) + bag(2) + bag(3) == 0) reset_bag();
+		hint(t);
+		return true;
+	}
+	unsigned value() const {
+		score v = 0;
+		for (unsigned i = 0; i < 16; i++) v += board::itov(operator()(i));
+		return v;
+	}
+
+public:
+	bool operator ==(const bitboard& b) const { return tile == b.tile; }
+	bool operator < (const bitboard& b) const { return tile <  b.tile; }
+	bool operator !=(const bitboard& b) const { return !(*this == b); }
+	bool operator > (const bitboard& b) const { return b < *this; }
+	bool operator <=(const bitboard& b) const { return !(b < *this); }
+	bool operator >=(const bitboard& b) const { return !(*this < b); }
+
+public:
+
+	/**
+	 * place a tile (index value) to the specific position (1-d index)
+	 * return >= 0 if the action is valid, or -1 if not
+	 */
+	reward place(unsigned pos, cell tile, cell hint_tile) {
+		data bak = info();
+		if (pos >= 16 || operator()(pos)) return -1;
+		if (hint() == 0 && !extract_hint_from_bag(tile)) return -1;
+		if (hint() != tile) return info(bak), -1;
+		if (!extract_hint_from_bag(hint_tile)) return info(bak), -1;
+		set(pos, tile);
+		last(4);
+		return board::itov(tile);
+	}
+
+	/**
+	 * apply an action to the board
+	 * return the reward of the action, or -1 if the action is illegal
+	 */
+	reward slide(unsigned opcode) {
+		reward r = -1;
+		switch (opcode & 0b11) {
+		case 0: r = slide_up(); break;
+		case 1: r = slide_right(); break;
+		case 2: r = slide_down(); break;
+		case 3: r = slide_left(); break;
+		}
+		if (r != -1) last(opcode & 0b11);
+		return r;
+	}
+
+	reward slide_left() {
+		return slide_rows(lookup().left, lookup().left_score);
+	}
+	reward slide_right() {
+		return slide_rows(lookup().right, lookup().right_score);
+	}
+	reward slide_up() {
+		transpose();
+		reward score = slide_rows(lookup().left, lookup().left_score);
+		transpose();
+		return score;
+	}
+	reward slide_down() {
+		transpose();
+		reward score = slide_rows(lookup().right, lookup().right_score);
+		transpose();
+		return score;
+	}
+
+	void rotate(int clockwise_count = 1) {
+		switch (((clockwise_count % 4) + 4) % 4) {
+		default:
+		case 0: break;
+		case 1: rotate_clockwise(); break;
+		case 2: reverse(); break;
+		case 3: rotate_counterclockwise(); break;
+		}
+	}
+
+	void rotate_clockwise() { transpose(); reflect_horizontal(); }
+	void rotate_counterclockwise() { transpose(); reflect_vertical(); }
+	void reverse() { reflect_horizontal(); reflect_vertical(); }
+
+	void reflect_horizontal() {
+		tile = ((tile & 0x000f000f000f000full) << 12) | ((tile & 0x00f000f000f000f0ull) << 4)
+		     | ((tile & 0x0f000f000f000f00ull) >> 4) | ((tile & 0xf000f000f000f000ull) >> 12);
+	}
+
+	void reflect_vertical() {
+		tile = (tile << 48) | ((tile & 0xffff0000ull) << 16) | ((tile >> 16) & 0xffff0000ull) | (tile >> 48);
+	}
+
+	void transpose() {
+		raw a = (tile & 0xf0f00f0ff0f00f0full) | ((tile & 0x0000f0f00000f0f0ull) << 12) | ((tile & 0x0f0f00000f0f0000ull) >> 12);
+		tile = (a & 0xff00ff0000ff00ffull) | ((a & 0x00ff00ff00000000ull) >> 24) | ((a & 0x00000000ff00ff00ull) << 24);
+	}
+
+public:
+	friend std::ostream& operator <<(std::ostream& out, const bitboard& b) {
+		return out << board(b);
+	}
+	friend std::istream& operator >>(std::istream& in, bitboard& b) {
+		board t({}, b.info());
+		in >> t;
+		b = t;
+		return in;
+	}
+
+private:
+	/**
+	 * the slide results of all 65536 rows, indexed by the 16-bit row word
+	 * since merged tiles are capped (t0 < 14), every result still fits in 4 bits per cell
+	 */
+	struct table {
+		std::array<uint16_t, 65536> left, right;
+		std::array<reward, 65536> left_score, right_score;
+		table() {
+			for (unsigned row = 0; row < 65536; row++) {
+				cell t[4] = { row & 0x0fu, (row >> 4) & 0x0fu, (row >> 8) & 0x0fu, (row >> 12) & 0x0fu };
+				reward score = 0;
+				for (int c = 1; c < 4; c++) {
+					cell& t0 = t[c - 1];
+					cell& t1 = t[c];
+					if (t0 == 0) {
+						t0 = t1;
+						t1 = 0;
+					} else if (t1 != 0 && ((t0 + t1 == 3) || (t0 == t1 && t0 >= 3 && t0 < 14))) {
+						t0 = std::max(t0, t1) + 1;
+						t1 = 0;
+						score += board::itov(t0) - board::itov(t0 - 1) * 2;
+					}
+				}
+				left[row] = t[0] | (t[1] << 4) | (t[2] << 8) | (t[3] << 12);
+				left_score[row] = score;
+			}
+			for (unsigned row = 0; row < 65536; row++) {
+				unsigned rev = mirror(row);
+				right[row] = mirror(left[rev]);
+				right_score[row] = left_score[rev];
+			}
+		}
+		static unsigned mirror(unsigned row) {
+			return ((row & 0x000fu) << 12) | ((row & 0x00f0u) << 4) | ((row & 0x0f00u) >> 4) | ((row & 0xf000u) >> 12);
+		}
+	};
+	static const table& lookup() { static const table t; return t; }
+
+	reward slide_rows(const std::array<uint16_t, 65536>& move, const std::array<reward, 65536>& gain) {
+		raw res = 0;
+		reward score = 0;
+		for (int r = 0; r < 64; r += 16) {
+			unsigned row = (tile >> r) & 0xffffu;
+			res |= raw(move[row]) << r;
+			score += gain[row];
+		}
+		if (res == tile) return -1;
+		tile = res;
+		return score;
+	}
+
+private:
+	raw tile;
+	data attr; // (#3-tile:4-bit) (#2-tile:4-bit) (#1-tile:4-bit) (last_action:4-bit) (hint_tile:4-bit)
+};
@@ -15,13 +15,24 @@
 #include <sstream>
 #include <chrono>
 #include <numeric>
+#include <mutex>
 #include "board.h"
 #include "action.h"
 #include "agent.h"
+#include "stopwatch.h"
 
+/**
+ * the moves are timed in nanoseconds (see stopwatch), and written in milliseconds to the text log:
+ * the milliseconds of each role carry the remainders over, so their sums match the nanoseconds
+ *
+ * with sample(K), only 1 in K moves of each role reads the clock, and the other moves of the role
+ * take the time of the last timed one
+ *
+ * the move buffers are recycled (see buffer), so the memory of the kept episodes follows their lengths
+ */
 class episode {
 public:
-	episode() : ep_state(initial_state()), ep_score(0), ep_time(0) { ep_moves.reserve(10000); }
+	episode() : ep_state(initial_state()), ep_score(0), ep_time(0), ep_timed(true), ep_turns{}, ep_last{} {}
 
 public:
 	board& state() { return ep_state; }
@@ -29,26 +40,51 @@ public:
 	board::score score() const { return ep_score; }
 
 	void open_episode(const std::string& tag) {
-		ep_open = { tag, millisec() };
+		ep_open = { tag, stopwatch::millisec(), stopwatch::nanosec() };
 	}
 	void close_episode(const std::string& tag) {
-		ep_close = { tag, millisec() };
+		ep_close = { tag, stopwatch::millisec(), stopwatch::nanosec() };
+	}
+	/**
+	 * close an episode whose moves were played between those of other games, e.g., by the batch engine,
+	 * so that its time is the sum of the times of its own moves instead of the whole interleaved run
+	 */
+	void close_episode(const std::string& tag, time_t span) {
+		ep_close = { tag, ep_open.when + span / 1000000, ep_open.tick + span };
 	}
 	bool apply_action(action move) {
 		board::reward reward = move.apply(state());
 		if (reward == -1) return false;
-		ep_moves.emplace_back(move, reward, millisec() - ep_time);
+		int role = (move.type() == action::slide::type);
+		if (ep_timed) ep_last[role] = stopwatch::nanosec() - ep_time;
+		ep_moves.emplace_back(move, reward, ep_last[role]);
 		ep_score += reward;
 		return true;
 	}
+	/**
+	 * record a move that was applied elsewhere, e.g., by the batch engine, which then sets state()
+	 */
+	void record(action move, board::reward reward, time_t time) {
+		ep_moves.emplace_back(move, reward, time);
+		ep_score += reward;
+	}
 	agent& take_turns(agent& slide, agent& place) {
-		ep_time = millisec();
-		return step() >= 9 && (step() - 8) % 2 ? slide : place;
+		bool role = step() >= 9 && (step() - 8) % 2;
+		ep_timed = (ep_turns[role]++ % period() == 0);
+		if (ep_timed) ep_time = stopwatch::nanosec();
+		return role ? slide : place;
 	}
 	agent& last_turns(agent& slide, agent& place) {
 		return step() >= 9 ? take_turns(place, slide) : place;
 	}
 
+	/**
+	 * time only 1 in k moves of every episode
+	 */
+	static void sample(size_t k) {
+		period() = k ?: 1;
+	}
+
 public:
 	size_t step(unsigned who = -1u) const {
 		size_t size = ep_moves.size();
@@ -71,7 +107,7 @@ public:
 			while (i < ep_moves.size()) time += ep_moves[i].time, i += 2;
 			break;
 		default:
-			time = ep_close.when - ep_open.when;
+			time = ep_close.tick - ep_open.tick;
 			break;
 		}
 		return time;
@@ -99,7 +135,14 @@ public:
 
 	friend std::ostream& operator <<(std::ostream& out, const episode& ep) {
 		out << ep.ep_open << '|';
-		for (const move& mv : ep.ep_moves) out << mv;
+		time_t spent[2] = {}, shown[2] = {}; // the nanoseconds and the milliseconds written of each role
+		for (const move& mv : ep.ep_moves) {
+			int role = (mv.code.type() == action::slide::type);
+			spent[role] += mv.time;
+			time_t ms = spent[role] / 1000000 - shown[role];
+			shown[role] += ms;
+			out << move(mv.code, mv.reward, ms);
+		}
 		out << '|' << ep.ep_close;
 		return out;
 	}
@@ -112,13 +155,146 @@ public:
 		for (std::stringstream moves(token); !moves.eof(); moves.peek()) {
 			ep.ep_moves.emplace_back();
 			moves >> ep.ep_moves.back();
+			ep.ep_moves.back().time *= 1000000;
 			ep.ep_score += action(ep.ep_moves.back()).apply(ep.ep_state);
 		}
 		std::getline(in, token, '|');
 		std::stringstream(token) >> ep.ep_close;
+		ep.ep_open.tick = ep.ep_open.when * 1000000;
+		ep.ep_close.tick = ep.ep_close.when * 1000000;
+		return in;
+	}
+
+	/**
+	 * the binary record of an episode, prefixed by its length in bytes: open tag, open time (ms),
+	 * close time - open time (ms), duration (ns), close tag, number of moves, then every move
+	 *
+	 * a move is one byte (0 r t 0 0 0 o o) for a slide of opcode o, or two bytes
+	 * (1 r t 0 p p p p) (t t t t h h h h) for a placement of tile t with hint h at position p,
+	 * followed by its reward if r is set and its time (ns) if t is set
+	 *
+	 * records of version 1 have no duration, and their times are in milliseconds
+	 *
+	 * integers are zigzag varints, and strings are prefixed by their lengths
+	 */
+	void write(std::ostream& out) const {
+		std::string buf;
+		put(buf, ep_open.tag);
+		put(buf, ep_open.when);
+		put(buf, ep_close.when - ep_open.when);
+		put(buf, ep_close.tick - ep_open.tick);
+		put(buf, ep_close.tag);
+		put(buf, ep_moves.size());
+		for (const move& mv : ep_moves) {
+			unsigned flag = (mv.reward ? 0x40 : 0) | (mv.time ? 0x20 : 0);
+			if (mv.code.type() == action::slide::type) {
+				buf.push_back(char(flag | (mv.code.event() & 0b11)));
+			} else {
+				action::place pl(mv.code);
+				buf.push_back(char(0x80 | flag | pl.position()));
+				buf.push_back(char((pl.tile() << 4) | (pl.hint() & 0x0f)));
+			}
+			if (mv.reward) put(buf, mv.reward);
+			if (mv.time) put(buf, mv.time);
+		}
+		std::string len;
+		put(len, buf.size());
+		out.write(len.data(), len.size());
+		out.write(buf.data(), buf.size());
+	}
+	/**
+	 * read a binary record, and fail the stream if the record is truncated or malformed
+	 */
+	std::istream& read(std::istream& in, unsigned version = 2) {
+		*this = {};
+		int64_t size = 0;
+		if (!get(in, size)) return in;
+		if (size < 0 || size > max_record) {
+			in.setstate(std::ios::failbit);
+			return in;
+		}
+		std::string buf; // read by chunks, so a corrupted size cannot allocate more than the bytes left and a chunk
+		for (int64_t got = 0, n; got < size; got += n) {
+			n = std::min<int64_t>(size - got, 1 << 20);
+			buf.resize(got + n);
+			if (!in.read(&buf[got], n)) {
+				in.setstate(std::ios::failbit);
+				return in;
+			}
+		}
+		const char* it = buf.data();
+		const char* end = it + buf.size();
+		int64_t when = 0, span = 0, tick = 0, count = 0;
+		time_t unit = version >= 2 ? 1 : 1000000;
+		bool ok = get(it, end, ep_open.tag) && get(it, end, when) && get(it, end, span);
+		ok = ok && (version < 2 || get(it, end, tick)) && get(it, end, ep_close.tag) && get(it, end, count);
+		ep_open.when = when;
+		ep_close.when = when + span;
+		ep_open.tick = when * 1000000;
+		ep_close.tick = ep_open.tick + (version >= 2 ? tick : span * 1000000);
+		for (int64_t i = 0; ok && i < count; i++) {
+			if (!(ok = it < end)) break;
+			unsigned head = uint8_t(*(it++)), body = 0;
+			if ((head & 0x80) && (ok = it < end)) body = uint8_t(*(it++));
+			move mv(head & 0x80 ? action(action::place(head & 0x0f, body >> 4, body & 0x0f)) : action(action::slide(head & 0b11)));
+			int64_t reward = 0, time = 0;
+			if (head & 0x40) ok = ok && get(it, end, reward);
+			if (head & 0x20) ok = ok && get(it, end, time);
+			mv.reward = reward;
+			mv.time = time * unit;
+			ep_moves.push_back(mv);
+			ep_score += action(mv).apply(ep_state);
+		}
+		if (!ok) in.setstate(std::ios::failbit);
 		return in;
 	}
 
+protected:
+	static const int64_t max_record = int64_t(1) << 30; // far beyond the record of any real episode
+
+	static void put(std::string& buf, int64_t v) {
+		uint64_t z = (uint64_t(v) << 1) ^ uint64_t(v >> 63);
+		for (; z >= 0x80; z >>= 7) buf.push_back(char(z | 0x80));
+		buf.push_back(char(z));
+	}
+	static void put(std::string& buf, const std::string& str) {
+		put(buf, int64_t(str.size()));
+		buf += str;
+	}
+	static bool get(const char*& it, const char* end, int64_t& v) {
+		uint64_t z = 0;
+		for (unsigned shift = 0; it < end && shift < 64; shift += 7) {
+			uint8_t byte = *(it++);
+			z |= uint64_t(byte & 0x7f) << shift;
+			if (byte < 0x80) {
+				v = int64_t(z >> 1) ^ -int64_t(z & 1);
+				return true;
+			}
+		}
+		return false;
+	}
+	static bool get(const char*& it, const char* end, std::string& str) {
+		int64_t size;
+		if (!get(it, end, size) || size < 0 || size > end - it) return false;
+		str.assign(it, size);
+		it += size;
+		return true;
+	}
+	static bool get(std::istream& in, int64_t& v) {
+		uint64_t z = 0;
+		for (unsigned shift = 0; shift < 64; shift += 7) {
+			int byte = in.get();
+			if (byte == EOF) return false;
+			z |= uint64_t(byte & 0x7f) << shift;
+			if (byte < 0x80) {
+				v = int64_t(z >> 1) ^ -int64_t(z & 1);
+				return true;
+			}
+		}
+		in.setstate(std::ios::failbit);
+		return false;
+	}
+
 protected:
 
 	struct move {
@@ -154,8 +330,9 @@ protected:
 
 	struct meta {
 		std::string tag;
-		time_t when;
-		meta(const std::string& tag = "N/A", time_t when = 0) : tag(tag), when(when) {}
+		time_t when; // the wall clock in milliseconds
+		time_t tick; // the stopwatch in nanoseconds
+		meta(const std::string& tag = "N/A", time_t when = 0, time_t tick = 0) : tag(tag), when(when), tick(tick) {}
 
 		friend std::ostream& operator <<(std::ostream& out, const meta& m) {
 			return out << m.tag << "@" << std::dec << m.when;
@@ -165,19 +342,59 @@ protected:
 		}
 	};
 
+	/**
+	 * the moves of an episode, in a buffer taken from the free buffers of the finished episodes and
+	 * given back when the episode is destroyed, so a run does not allocate (and fault in) every episode;
+	 * a new buffer grows with its game, so each buffer is about the length of the longest game it held
+	 */
+	class buffer : public std::vector<move> {
+	public:
+		buffer() { recycler().take(*this); }
+		buffer(const buffer& b) : buffer() { assign(b.begin(), b.end()); }
+		buffer(buffer&& b) : std::vector<move>(std::move(b)) {}
+		buffer& operator =(const buffer& b) { assign(b.begin(), b.end()); return *this; }
+		buffer& operator =(buffer&& b) { swap(b); return *this; } // the old buffer is given back by b
+		~buffer() { recycler().give(*this); }
+
+	private:
+		/**
+		 * the free buffers shared by all threads, of which at most keep are held
+		 */
+		class pool {
+		public:
+			void take(std::vector<move>& buf) {
+				std::lock_guard<std::mutex> guard(lock);
+				if (free.empty()) return;
+				buf.swap(free.back());
+				free.pop_back();
+			}
+			void give(std::vector<move>& buf) {
+				if (!buf.capacity()) return;
+				buf.clear();
+				std::lock_guard<std::mutex> guard(lock);
+				if (free.size() < keep) free.push_back(std::move(buf));
+			}
+		private:
+			static const size_t keep = 64;
+			std::mutex lock;
+			std::vector<std::vector<move>> free;
+		};
+		static pool& recycler() { static pool p; return p; }
+	};
+
 	static board initial_state() {
 		return {};
 	}
-	static time_t millisec() {
-		auto now = std::chrono::system_clock::now().time_since_epoch();
-		return std::chrono::duration_cast<std::chrono::milliseconds>(now).count();
-	}
+	static size_t& period() { static size_t k = 1; return k; }
 
 private:
 	board ep_state;
 	board::score ep_score;
-	std::vector<move> ep_moves;
+	buffer ep_moves;
 	time_t ep_time;
+	bool ep_timed;
+	size_t ep_turns[2]; // the turns taken by the placer and by the slider
+	time_t ep_last[2]; // the last timed move of the placer and of the slider
 
 	meta ep_open;
 	meta ep_close;
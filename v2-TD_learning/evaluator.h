@@ -0,0 +1,259 @@
+/**
+ * Framework for Threes! and its variants (C++ 11)
+ * evaluator.h: Batched n-tuple network evaluation of packed boards
+ *
+ * Author: Theory of Computer Games
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <stdexcept>
+#include <immintrin.h>
+#include "bitboard.h"
+#include "feature.h"
+#include "weight.h"
+#include "profile.h"
+
+/**
+ * evaluate boards with the patterns of a feature set and their tables
+ *
+ * the value of a board accumulates one lane per isomorphism over the patterns,
+ * then reduces the 8 lanes as ((0+4)+(2+6)) + ((1+5)+(3+7)); the AVX2 path computes
+ * the indices of all 8 isomorphisms with vector shifts and masks, fetches the
+ * weights with gathers, and follows the same order, so both paths give the same
+ * values bit for bit and therefore pick the same moves
+ *
+ * the tables are either float (weight) or 16-bit fixed-point (quantized), whose entries
+ * are converted and scaled in the same way by both paths
+ *
+ * the AVX2 path is selected at runtime if the processor supports it, and if every
+ * table can be indexed by 32-bit signed integers
+ *
+ * with prefetch, the indices of a batch of boards are computed first, and their table
+ * lines are prefetched before any weight is summed, so that the cache misses overlap
+ *
+ * the scalar path extracts the indices with the given extractor (e.g., network::indices)
+ * if any, which must agree with the feature set, or with the feature set otherwise
+ */
+class evaluator {
+public:
+	typedef void (*extractor)(const bitboard& b, size_t* index);
+
+	evaluator(const feature_set& features = {}, bool simd = true, bool prefetch = true, extractor unrolled = nullptr) :
+		features(features), unrolled(unrolled), avx2(false), ahead(prefetch) {
+		if (features.size() > max_patterns) throw std::invalid_argument("evaluator: too many patterns");
+		bool fits = true; // the gathers take 32-bit signed indices
+		for (size_t p = 0; p < features.size(); p++) fits &= features[p].size() <= size_t(INT32_MAX);
+		if (simd && fits) avx2 = __builtin_cpu_supports("avx2");
+		for (size_t p = 0; p < features.size(); p++) {
+			const pattern& pt = features[p];
+			for (unsigned j = 0; j < pt.length(); j++) {
+				lane ln;
+				for (unsigned i = 0; i < pattern::isomorphisms; i++) {
+					unsigned cell = pt.cell(j, i);
+					ln.select[i] = cell >= 8 ? -1 : 0;
+					ln.shift[i] = (cell % 8) * 4;
+				}
+				lanes.push_back(ln);
+			}
+		}
+	}
+
+public:
+	bool vectorized() const { return avx2; }
+	bool prefetching() const { return ahead; }
+
+	/**
+	 * the value of a board
+	 */
+	template<class table>
+	float value(const std::vector<table>& net, const bitboard& b) const {
+		float v;
+		values(net, &b, 1, &v);
+		return v;
+	}
+
+	/**
+	 * the values of n boards, e.g., all afterstates of a node
+	 */
+	template<class table>
+	void values(const std::vector<table>& net, const bitboard* b, size_t n, float* out) const {
+		if (avx2) return values_avx2(net, b, n, out);
+		for (size_t k = 0; k < n; k += batch) {
+			size_t m = std::min(n - k, size_t(batch));
+			size_t index[batch][max_count];
+			{
+				PROFILE_SCOPE(profile::extract, m);
+				for (size_t q = 0; q < m; q++) indices(b[k + q], index[q]);
+			}
+			PROFILE_SCOPE(profile::lookup, m);
+			if (ahead && m > 1) { // the loads of a single board overlap anyway
+				for (size_t q = 0; q < m; q++) prefetch(net, index[q]);
+			}
+			for (size_t q = 0; q < m; q++) out[k + q] = value(net, index[q]);
+		}
+	}
+
+	/**
+	 * prefetch the table lines of n boards that will be evaluated soon
+	 */
+	template<class table>
+	void prefetch(const std::vector<table>& net, const bitboard* b, size_t n) const {
+		if (!ahead) return;
+		if (avx2) return prefetch_avx2(net, b, n);
+		size_t index[max_count];
+		for (size_t k = 0; k < n; k++) {
+			indices(b[k], index);
+			prefetch(net, index);
+		}
+	}
+
+	template<class table>
+	void prefetch(const std::vector<table>& net, const size_t* index) const {
+		for (unsigned i = 0; i < pattern::isomorphisms; i++) {
+			for (size_t p = 0; p < features.size(); p++) __builtin_prefetch(net[p].data() + *(index++));
+		}
+	}
+
+	/**
+	 * the value of indices extracted by feature_set::indices
+	 */
+	template<class table>
+	float value(const std::vector<table>& net, const size_t* index) const {
+		float acc[pattern::isomorphisms] = {};
+		for (unsigned i = 0; i < pattern::isomorphisms; i++) {
+			for (size_t p = 0; p < features.size(); p++) acc[i] += net[p][*(index++)];
+		}
+		return reduce(acc);
+	}
+
+private:
+	void indices(const bitboard& b, size_t* index) const {
+		if (unrolled) unrolled(b, index);
+		else features.indices(b, index);
+	}
+
+	static float reduce(const float* acc) {
+		return ((acc[0] + acc[4]) + (acc[2] + acc[6])) + ((acc[1] + acc[5]) + (acc[3] + acc[7]));
+	}
+
+	/**
+	 * the indices of all 8 isomorphisms of each pattern, one pattern per vector
+	 */
+	__attribute__((target("avx2")))
+	void indices_avx2(bitboard::raw raw, __m256i* idx) const {
+		const __m256i mask = _mm256_set1_epi32(0x0f);
+		__m256i lo = _mm256_set1_epi32(uint32_t(raw));
+		__m256i hi = _mm256_set1_epi32(uint32_t(raw >> 32));
+		const lane* ln = lanes.data();
+		for (size_t p = 0; p < features.size(); p++) {
+			const pattern& pt = features[p];
+			idx[p] = _mm256_setzero_si256();
+			if (pt.base() == 16) {
+				for (unsigned j = 0; j < pt.length(); j++, ln++) {
+					__m256i src = _mm256_blendv_epi8(lo, hi, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ln->select)));
+					__m256i nib = _mm256_and_si256(_mm256_srlv_epi32(src, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ln->shift))), mask);
+					idx[p] = _mm256_or_si256(_mm256_slli_epi32(idx[p], 4), nib);
+				}
+			} else {
+				const __m256i radix = _mm256_set1_epi32(pt.base());
+				const __m256i top = _mm256_set1_epi32(pt.base() - 1);
+				for (unsigned j = 0; j < pt.length(); j++, ln++) {
+					__m256i src = _mm256_blendv_epi8(lo, hi, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ln->select)));
+					__m256i nib = _mm256_and_si256(_mm256_srlv_epi32(src, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ln->shift))), mask);
+					idx[p] = _mm256_add_epi32(_mm256_mullo_epi32(idx[p], radix), _mm256_min_epu32(nib, top));
+				}
+			}
+		}
+	}
+
+	template<class table>
+	__attribute__((target("avx2")))
+	void prefetch_avx2(const std::vector<table>& net, const __m256i* idx) const {
+		for (size_t p = 0; p < features.size(); p++) {
+			alignas(32) int32_t at[pattern::isomorphisms];
+			_mm256_store_si256(reinterpret_cast<__m256i*>(at), idx[p]);
+			const typename table::type* data = net[p].data();
+			for (unsigned i = 0; i < pattern::isomorphisms; i++) __builtin_prefetch(data + at[i]);
+		}
+	}
+
+	template<class table>
+	__attribute__((target("avx2")))
+	void prefetch_avx2(const std::vector<table>& net, const bitboard* b, size_t n) const {
+		__m256i idx[max_patterns];
+		for (size_t k = 0; k < n; k++) {
+			indices_avx2(b[k].bits(), idx);
+			prefetch_avx2(net, idx);
+		}
+	}
+
+	/**
+	 * compute the indices of a batch of boards first, prefetch all their lines,
+	 * then gather and accumulate the weights
+	 */
+	template<class table>
+	__attribute__((target("avx2")))
+	void values_avx2(const std::vector<table>& net, const bitboard* b, size_t n, float* out) const {
+		for (size_t k = 0; k < n; k += batch) {
+			size_t m = std::min(n - k, size_t(batch));
+			__m256i idx[batch][max_patterns];
+			{
+				PROFILE_SCOPE(profile::extract, m);
+				for (size_t q = 0; q < m; q++) indices_avx2(b[k + q].bits(), idx[q]);
+			}
+			PROFILE_SCOPE(profile::lookup, m);
+			if (ahead && m > 1) {
+				for (size_t q = 0; q < m; q++) prefetch_avx2(net, idx[q]);
+			}
+			for (size_t q = 0; q < m; q++) {
+				__m256 acc = _mm256_setzero_ps();
+				for (size_t p = 0; p < features.size(); p++) {
+					acc = _mm256_add_ps(acc, gather(net[p], idx[q][p]));
+				}
+				__m128 v = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1)); // (0+4) (1+5) (2+6) (3+7)
+				v = _mm_add_ps(v, _mm_movehl_ps(v, v)); // ((0+4)+(2+6)) ((1+5)+(3+7))
+				v = _mm_add_ss(v, _mm_shuffle_ps(v, v, 1));
+				out[k + q] = _mm_cvtss_f32(v);
+			}
+		}
+	}
+
+	__attribute__((target("avx2")))
+	static __m256 gather(const weight& w, __m256i idx) {
+		return _mm256_i32gather_ps(w.data(), idx, sizeof(weight::type));
+	}
+
+	/**
+	 * gather the 32-bit words at the 16-bit entries, and sign-extend their low halves
+	 */
+	__attribute__((target("avx2")))
+	static __m256 gather(const quantized& w, __m256i idx) {
+		__m256i word = _mm256_i32gather_epi32(reinterpret_cast<const int*>(w.data()), idx, sizeof(quantized::type));
+		__m256i entry = _mm256_srai_epi32(_mm256_slli_epi32(word, 16), 16);
+		return _mm256_mul_ps(_mm256_cvtepi32_ps(entry), _mm256_set1_ps(w.scale()));
+	}
+
+private:
+	/**
+	 * the per-isomorphism source word (low or high 32 bits) and shift of one tuple cell
+	 */
+	struct lane {
+		int32_t select[pattern::isomorphisms];
+		int32_t shift[pattern::isomorphisms];
+	};
+
+	static const size_t batch = 4; // the boards whose lines are prefetched together
+	static const size_t max_patterns = 16;
+	static const size_t max_count = max_patterns * pattern::isomorphisms;
+
+	feature_set features;
+	extractor unrolled;
+	std::vector<lane> lanes;
+	bool avx2;
+	bool ahead;
+};
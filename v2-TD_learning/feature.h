@@ -0,0 +1,173 @@
+/**
+ * Framework for Threes! and its variants (C++ 11)
+ * feature.h: Isomorphic n-tuple feature extraction on packed boards
+ *
+ * Author: Theory of Computer Games
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <array>
+#include <vector>
+#include <cstdint>
+#include <stdexcept>
+#include <type_traits>
+#include <algorithm>
+#include "bitboard.h"
+
+/**
+ * an n-tuple pattern with the cell lists of its 8 isomorphisms
+ *
+ * the lists are precomputed once, so that an index is built by shifting
+ * the packed board directly, without rotating or reflecting any copy
+ *
+ * isomorphism (i) is the board after (i / 2 + 1) clockwise rotations,
+ * followed by a horizontal reflection if (i) is even
+ *
+ * each cell is a digit of the given radix: radix 16 packs the 4-bit tiles
+ * directly, while a smaller radix clamps the rare large tiles to (radix - 1)
+ */
+class pattern {
+public:
+	static const unsigned isomorphisms = 8;
+	static const unsigned max_length = 8;
+
+public:
+	pattern(const std::vector<unsigned>& cells = {}, size_t radix = 20) : len(cells.size()), radix(radix) {
+		if (len > max_length) throw std::invalid_argument("pattern: too many cells");
+		bitboard iso;
+		for (unsigned i = 0; i < 16; i++) iso.set(i, i);
+		for (unsigned i = 0; i < isomorphisms; i++) {
+			if (i % 2 == 0) iso.rotate_clockwise();
+			iso.reflect_horizontal();
+			for (unsigned j = 0; j < len; j++) shift[i][j] = 4 * iso(cells[j]);
+		}
+	}
+
+public:
+	unsigned length() const { return len; }
+	size_t base() const { return radix; }
+	unsigned cell(unsigned j, unsigned i = 0) const { return shift[i][j] / 4; }
+
+	/**
+	 * the number of table entries this pattern indexes
+	 */
+	size_t size() const {
+		size_t n = 1;
+		for (unsigned j = 0; j < len; j++) n *= radix;
+		return n;
+	}
+
+	/**
+	 * the index of isomorphism (i) on the packed board
+	 */
+	size_t index(bitboard::raw b, unsigned i) const {
+		size_t value = 0;
+		if (radix == 16) {
+			for (unsigned j = 0; j < len; j++) value = (value << 4) | ((b >> shift[i][j]) & 0x0fu);
+		} else {
+			for (unsigned j = 0; j < len; j++) value = value * radix + std::min<size_t>((b >> shift[i][j]) & 0x0fu, radix - 1);
+		}
+		return value;
+	}
+
+private:
+	unsigned len;
+	size_t radix;
+	std::array<std::array<uint8_t, max_length>, isomorphisms> shift;
+};
+
+/**
+ * a list of patterns, extracted together in one pass
+ *
+ * the indices are laid out isomorphism-major, i.e.,
+ * the index of pattern (p) under isomorphism (i) is at [i * size() + p]
+ */
+class feature_set {
+public:
+	feature_set(const std::vector<std::vector<unsigned>>& tuples = {}, size_t radix = 20) {
+		for (const auto& cells : tuples) list.emplace_back(cells, radix);
+	}
+
+public:
+	size_t size() const { return list.size(); }
+	size_t count() const { return list.size() * pattern::isomorphisms; }
+	const pattern& operator [](size_t p) const { return list[p]; }
+
+	/**
+	 * extract all count() indices of the board into out
+	 */
+	void indices(const bitboard& b, size_t* out) const {
+		bitboard::raw raw = b.bits();
+		for (unsigned i = 0; i < pattern::isomorphisms; i++) {
+			for (const pattern& p : list) *(out++) = p.index(raw, i);
+		}
+	}
+
+private:
+	std::vector<pattern> list;
+};
+
+/**
+ * the cell of the original board that isomorphism (i) of the pattern class moves to position (pos),
+ * as a constant: clockwise rotation takes (r, c) from (3 - c, r), and horizontal reflection from (r, 3 - c)
+ */
+struct isomorphism {
+	static constexpr unsigned rotate(unsigned pos) { return (3 - pos % 4) * 4 + pos / 4; }
+	static constexpr unsigned reflect(unsigned pos) { return pos / 4 * 4 + (3 - pos % 4); }
+	static constexpr unsigned step(unsigned i, unsigned pos) { return i % 2 == 0 ? rotate(reflect(pos)) : reflect(pos); }
+	static constexpr unsigned cell(unsigned i, unsigned pos) { return i == 0 ? step(0, pos) : cell(i - 1, step(i, pos)); }
+};
+
+/**
+ * an n-tuple pattern of radix 16 whose cells are template arguments, so that the shifts of
+ * every isomorphism are constants, and index<i>() unrolls into shifts and masks
+ */
+template<unsigned... cells>
+struct ntuple {
+	static constexpr unsigned length = sizeof...(cells);
+	static constexpr size_t size = size_t(1) << (4 * length);
+
+	static std::vector<unsigned> shape() { return { cells... }; }
+
+	template<unsigned i>
+	static size_t index(bitboard::raw b) { return digits<i, cells...>::fold(b, 0); }
+
+private:
+	template<unsigned i, unsigned... rest>
+	struct digits {
+		static size_t fold(bitboard::raw, size_t value) { return value; }
+	};
+	template<unsigned i, unsigned cell, unsigned... rest>
+	struct digits<i, cell, rest...> {
+		static size_t fold(bitboard::raw b, size_t value) {
+			return digits<i, rest...>::fold(b, (value << 4) | ((b >> (4 * isomorphism::cell(i, cell))) & 0x0fu));
+		}
+	};
+};
+
+/**
+ * a list of ntuple patterns, which extracts the same indices as the feature_set of its shapes() with radix 16
+ */
+template<class... tuples>
+struct network {
+	static constexpr size_t size = sizeof...(tuples);
+	static constexpr size_t count = size * pattern::isomorphisms;
+
+	static std::vector<std::vector<unsigned>> shapes() { return { tuples::shape()... }; }
+
+	static void indices(const bitboard& b, size_t* out) {
+		extract<0>(b.bits(), out);
+	}
+
+private:
+	template<unsigned i>
+	static typename std::enable_if<(i < pattern::isomorphisms)>::type extract(bitboard::raw b, size_t* out) {
+		int order[] = { (*(out++) = tuples::template index<i>(b), 0)... }; // a braced list is evaluated in order
+		(void) order;
+		extract<i + 1>(b, out);
+	}
+	template<unsigned i>
+	static typename std::enable_if<(i == pattern::isomorphisms)>::type extract(bitboard::raw, size_t*) {}
+};
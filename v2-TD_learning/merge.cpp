@@ -0,0 +1,237 @@
+/**
+ * Framework for Threes! and its variants (C++ 11)
+ * merge.cpp: Average or merge the weight tables of sharded training runs
+ *
+ * Author: Theory of Computer Games
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#include <iostream>
+#include <iterator>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <cstdint>
+#include <cstdlib>
+#include <cstdio>
+#include <immintrin.h>
+#include "weight.h"
+#include "archive.h"
+
+/**
+ * the tables of a weight file, either as saved by weight_agent::save_weights (the count, then
+ * the size and the entries of each table), or a float archive (see archive.h), whose tuple shapes
+ * are also known; the entries are read by chunks, so only the chunks being merged are in memory
+ */
+class source {
+public:
+	source(const std::string& path) : path(path) {
+		if (archive::detect(path)) {
+			if (archive::element(path) != sizeof(weight::type)) fail("has quantized tables, which cannot be merged");
+			uint32_t radix;
+			try {
+				mapped = archive::map<weight>(path, tuples, radix);
+			} catch (std::exception& e) {
+				fail(e.what());
+			}
+			for (const weight& w : mapped) sizes.push_back(w.size());
+			return;
+		}
+		in.open(path, std::ios::in | std::ios::binary);
+		if (!in.is_open()) fail("cannot be opened");
+		in.seekg(0, std::ios::end);
+		uint64_t length = in.tellg(), at = sizeof(uint32_t);
+		in.seekg(0);
+		uint32_t count = 0;
+		if (!in.read(reinterpret_cast<char*>(&count), sizeof(count))) fail("is not a weight file");
+		for (uint32_t i = 0; i < count; i++) { // find the tables without reading them
+			uint64_t size = 0;
+			in.seekg(at);
+			if (!in.read(reinterpret_cast<char*>(&size), sizeof(size)) || size > (length - at - sizeof(size)) / sizeof(weight::type))
+				fail("is truncated at table " + std::to_string(i));
+			sizes.push_back(size);
+			offsets.push_back(at + sizeof(size));
+			at += sizeof(size) + size * sizeof(weight::type);
+		}
+	}
+
+public:
+	const std::string& name() const { return path; }
+	size_t count() const { return sizes.size(); }
+	size_t size(size_t t) const { return sizes[t]; }
+	const archive::shapes& shapes() const { return tuples; }
+
+	/**
+	 * the n entries of table t starting at entry i
+	 */
+	void read(size_t t, size_t i, size_t n, float* out) {
+		if (mapped.size()) {
+			std::memcpy(out, mapped[t].data() + i, n * sizeof(float));
+			return;
+		}
+		in.seekg(offsets[t] + i * sizeof(float));
+		if (!in.read(reinterpret_cast<char*>(out), n * sizeof(float))) fail("cannot be read");
+	}
+
+	void fail(const std::string& msg) const {
+		std::cerr << "merge: " << path << " " << msg << std::endl;
+		std::exit(-1);
+	}
+
+private:
+	std::string path;
+	std::ifstream in;
+	std::vector<uint64_t> sizes;
+	std::vector<uint64_t> offsets; // the entries of each table in the file
+	std::vector<weight> mapped; // the tables of an archive
+	archive::shapes tuples; // the shapes of an archive, or empty
+};
+
+/**
+ * acc[k] += w * x[k] for k in [0, n), with AVX2 if simd
+ */
+__attribute__((target("avx2")))
+void accumulate_avx2(float* acc, const float* x, float w, size_t n) {
+	size_t k = 0;
+	__m256 scale = _mm256_set1_ps(w);
+	for (; k + 8 <= n; k += 8) {
+		__m256 sum = _mm256_add_ps(_mm256_loadu_ps(acc + k), _mm256_mul_ps(scale, _mm256_loadu_ps(x + k)));
+		_mm256_storeu_ps(acc + k, sum);
+	}
+	for (; k < n; k++) acc[k] += w * x[k];
+}
+void accumulate(float* acc, const float* x, float w, size_t n, bool simd) {
+	if (simd) return accumulate_avx2(acc, x, w, n);
+	for (size_t k = 0; k < n; k++) acc[k] += w * x[k];
+}
+
+int main(int argc, const char* argv[]) {
+	std::cout << "Threes! Merge: ";
+	std::copy(argv, argv + argc, std::ostream_iterator<const char*>(std::cout, " "));
+	std::cout << std::endl << std::endl;
+
+	size_t chunk = 1 << 20;
+	bool simd = true;
+	std::string base_path, save_path, weights;
+	std::vector<std::string> paths;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		auto match_arg = [&](std::string flag) -> bool {
+			auto it = arg.find_first_not_of('-');
+			return arg.find(flag, it) == it;
+		};
+		auto next_opt = [&]() -> std::string {
+			auto it = arg.find('=') + 1;
+			return it ? arg.substr(it) : argv[++i];
+		};
+		if (arg[0] != '-') {
+			paths.push_back(arg);
+		} else if (match_arg("base")) {
+			base_path = next_opt();
+		} else if (match_arg("save")) {
+			save_path = next_opt();
+		} else if (match_arg("weights")) {
+			weights = next_opt();
+		} else if (match_arg("chunk")) {
+			chunk = std::max<size_t>(std::stoull(next_opt()), 1);
+		} else if (match_arg("simd")) {
+			simd = std::stoi(next_opt());
+		}
+	}
+	if (paths.empty() || save_path.empty()) {
+		std::cerr << "merge: usage: ./merge --save=merged.bin [--base=base.bin] [--weights=w1,w2,...] shard1.bin shard2.bin ..." << std::endl;
+		return -1;
+	}
+	simd = simd && __builtin_cpu_supports("avx2");
+
+	// the weight of each shard; the average divides them by their sum, while the merge into the base
+	// adds the weighted deltas of the shards, e.g., the sum of their updates with the default weights of 1
+	std::vector<float> coef;
+	std::stringstream list(weights);
+	for (std::string w; std::getline(list, w, ','); ) coef.push_back(std::stof(w));
+	if (coef.size() && coef.size() != paths.size()) {
+		std::cerr << "merge: " << coef.size() << " weights given for " << paths.size() << " shards" << std::endl;
+		return -1;
+	}
+	if (coef.empty()) coef.assign(paths.size(), 1);
+	if (base_path.empty()) {
+		float total = 0;
+		for (float w : coef) total += w;
+		if (total == 0) {
+			std::cerr << "merge: the weights sum to 0" << std::endl;
+			return -1;
+		}
+		for (float& w : coef) w /= total;
+	}
+
+	std::vector<std::unique_ptr<source>> shards;
+	for (const std::string& path : paths) shards.emplace_back(new source(path));
+	std::unique_ptr<source> base(base_path.size() ? new source(base_path) : nullptr);
+	std::vector<const source*> inputs;
+	if (base) inputs.push_back(base.get());
+	for (const auto& shard : shards) inputs.push_back(shard.get());
+	const source& first = *inputs[0];
+	const source* shaped = nullptr; // the first input whose tuple shapes are known, i.e., an archive
+	for (const source* in : inputs) {
+		if (in->count() != first.count())
+			in->fail("has " + std::to_string(in->count()) + " tables, but " + first.name() + " has " + std::to_string(first.count()));
+		for (size_t t = 0; t < first.count(); t++) {
+			if (in->size(t) != first.size(t))
+				in->fail("has " + std::to_string(in->size(t)) + " entries in table " + std::to_string(t) + ", but " + first.name() + " has " + std::to_string(first.size(t)));
+		}
+		if (in->shapes().empty()) continue; // a raw file has no shapes, so only its sizes are checked
+		if (!shaped) shaped = in;
+		if (in->shapes() != shaped->shapes())
+			in->fail("has other tuple shapes than " + shaped->name());
+	}
+
+	// the tables are written into a temporary file, which replaces --save only when it is complete,
+	// so that --save may name the base or a shard, whose entries are read while the output is written
+	std::string temp_path = save_path + ".tmp";
+	std::ofstream out(temp_path, std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!out.is_open()) {
+		std::cerr << "merge: cannot open " << temp_path << std::endl;
+		return -1;
+	}
+	auto start = std::chrono::steady_clock::now();
+	uint32_t count = first.count();
+	size_t entries = 0;
+	out.write(reinterpret_cast<const char*>(&count), sizeof(count));
+	std::vector<float> acc(chunk), origin(chunk), buf(chunk);
+	for (size_t t = 0; t < first.count(); t++) {
+		uint64_t size = first.size(t);
+		out.write(reinterpret_cast<const char*>(&size), sizeof(size));
+		for (size_t i = 0; i < size; i += chunk) {
+			size_t n = std::min<size_t>(chunk, size - i);
+			if (base) {
+				base->read(t, i, n, origin.data());
+				std::copy(origin.begin(), origin.begin() + n, acc.begin());
+			} else {
+				std::fill(acc.begin(), acc.begin() + n, 0);
+			}
+			for (size_t s = 0; s < shards.size(); s++) {
+				shards[s]->read(t, i, n, buf.data());
+				if (base) accumulate(buf.data(), origin.data(), -1, n, simd); // the delta of the shard
+				accumulate(acc.data(), buf.data(), coef[s], n, simd);
+			}
+			out.write(reinterpret_cast<const char*>(acc.data()), n * sizeof(float));
+		}
+		entries += size;
+	}
+	out.close();
+	if (!out || std::rename(temp_path.c_str(), save_path.c_str()) != 0) {
+		std::cerr << "merge: cannot write " << save_path << std::endl;
+		std::remove(temp_path.c_str());
+		return -1;
+	}
+	double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	std::cout << (base ? "merged " : "averaged ") << shards.size() << " shards" << (base ? " into " + base_path : "");
+	std::cout << ": " << count << " tables, " << entries << " entries, " << elapsed << " s" << (simd ? " (avx2)" : "") << std::endl;
+	return 0;
+}
@@ -0,0 +1,179 @@
+/**
+ * Framework for Threes! and its variants (C++ 11)
+ * pages.h: Huge-page and NUMA placement policies for the weight tables
+ *
+ * Author: Theory of Computer Games
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <memory>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+
+/**
+ * the pages of the large tables, and the nodes they are placed on
+ *
+ * pages=normal keeps the entries on the heap; thp maps them aligned to 2 MB and advises
+ * transparent huge pages; 2m and 1g map them from the explicit huge page pools
+ * (see /proc/sys/vm/nr_hugepages), and fall back to the next smaller kind if a pool is short
+ *
+ * numa=local leaves the pages on the node that first touches them; interleave spreads
+ * them over all nodes; replicate also interleaves the tables, and gives each fork of a
+ * read-only agent (alpha=0) a copy of the tables on the node of its thread (see weight_agent)
+ *
+ * the kinds and placements actually applied are counted for report()
+ */
+class pages {
+public:
+	enum kind { normal, transparent, huge2m, huge1g, kinds };
+	enum placement { local, interleave, replicate };
+
+	static const size_t threshold = size_t(1) << 21; // smaller tables are always on the heap
+
+	/**
+	 * select the policies by name, or exit on an unknown one
+	 */
+	static void configure(const std::string& size, const std::string& numa) {
+		const char* sizes[] = { "normal", "thp", "2m", "1g" };
+		const char* places[] = { "local", "interleave", "replicate" };
+		int k = -1, p = -1;
+		for (int i = 0; i < 4; i++) if (size == sizes[i]) k = i;
+		for (int i = 0; i < 3; i++) if (numa == places[i]) p = i;
+		if (k < 0 || p < 0) {
+			std::cerr << "pages: unknown policy pages=" << size << " numa=" << numa << std::endl;
+			std::exit(-1);
+		}
+		config().size = kind(k);
+		config().numa = placement(p);
+	}
+	static kind size() { return config().size; }
+	static placement numa() { return config().numa; }
+
+	/**
+	 * whether a table of the given bytes is allocated by allocate() rather than on the heap
+	 */
+	static bool mapped(size_t bytes) {
+		return bytes >= threshold && (size() != normal || numa() != local || bound() >= 0);
+	}
+
+	/**
+	 * map zeroed memory by the policies, and return it with the owner that unmaps it
+	 */
+	static void* allocate(size_t bytes, std::shared_ptr<void>& owner) {
+		static const size_t unit[] = { 4096, size_t(1) << 21, size_t(1) << 21, size_t(1) << 30 };
+		void* base = MAP_FAILED;
+		size_t len = 0;
+		int k = size();
+		for (; k >= huge2m && base == MAP_FAILED; k--) {
+			len = (bytes + unit[k] - 1) / unit[k] * unit[k];
+			int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | ((k == huge1g ? 30 : 21) << MAP_HUGE_SHIFT);
+			base = ::mmap(nullptr, len, PROT_READ | PROT_WRITE, flags, -1, 0);
+			if (base != MAP_FAILED) break;
+		}
+		char* data = static_cast<char*>(base);
+		if (base == MAP_FAILED) { // over-map by 2 MB to align the transparent huge pages
+			len = (bytes + unit[transparent] - 1) / unit[transparent] * unit[transparent] + unit[transparent];
+			base = ::mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (base == MAP_FAILED) {
+				std::cerr << "pages: cannot map " << bytes << " bytes" << std::endl;
+				std::exit(-1);
+			}
+			data = static_cast<char*>(base) + (-reinterpret_cast<uintptr_t>(base) & (unit[transparent] - 1));
+			k = (k >= transparent && ::madvise(data, len - unit[transparent], MADV_HUGEPAGE) == 0) ? transparent : normal;
+		}
+		count(k)++;
+		place(data, len - (data - static_cast<char*>(base)));
+		owner.reset(data, [base, len](void*) { ::munmap(base, len); });
+		return data;
+	}
+
+	/**
+	 * the tables allocated by this thread while bound are placed on the node, e.g., for a replica
+	 */
+	class binding {
+	public:
+		binding(int node) : last(bound()) { bound() = node; }
+		~binding() { bound() = last; }
+	private:
+		int last;
+	};
+
+	/**
+	 * the number of online nodes, from the last node in /sys/devices/system/node/online (e.g., "0-1")
+	 */
+	static int nodes() {
+		static int n = []() {
+			std::ifstream in("/sys/devices/system/node/online");
+			std::string list;
+			if (!(in >> list)) return 1;
+			size_t at = list.find_last_of(",-");
+			return std::atoi(list.substr(at == std::string::npos ? 0 : at + 1).c_str()) + 1;
+		}();
+		return n;
+	}
+	static int current_node() {
+		unsigned cpu = 0, node = 0;
+		return ::syscall(SYS_getcpu, &cpu, &node, nullptr) == 0 ? int(node) : 0;
+	}
+
+	/**
+	 * the kinds of pages and the placement applied to the tables allocated so far,
+	 * e.g., "pages = 2m x 4, thp x 2 (2m requested), numa = interleave over 2 nodes"
+	 */
+	static std::string report() {
+		const char* sizes[] = { "normal", "thp", "2m", "1g" };
+		const char* places[] = { "local", "interleave", "replicate" };
+		std::stringstream ss;
+		ss << "pages = ";
+		size_t total = 0;
+		for (int k = kinds - 1; k >= 0; k--) {
+			if (!count(k)) continue;
+			ss << (total ? ", " : "") << sizes[k] << " x " << count(k);
+			total += count(k);
+		}
+		if (!total) ss << "heap";
+		if (size() != normal && count(size()) != total + !total) ss << " (" << sizes[size()] << " requested)";
+		ss << ", numa = ";
+		if (numa() == local || nodes() < 2) ss << "local" << (numa() != local ? " (" + std::string(places[numa()]) + " requested, 1 node)" : "");
+		else ss << places[numa()] << " over " << nodes() << " nodes" << (placed() ? "" : " (mbind failed)");
+		return ss.str();
+	}
+
+private:
+	struct state {
+		kind size = normal;
+		placement numa = local;
+		std::atomic<size_t> count[kinds];
+		std::atomic<bool> failed;
+		state() : failed(false) { for (std::atomic<size_t>& n : count) n = 0; }
+	};
+	static state& config() { static state s; return s; }
+	static std::atomic<size_t>& count(int k) { return config().count[k]; }
+	static bool placed() { return !config().failed; }
+	static int& bound() { static thread_local int node = -1; return node; }
+
+	/**
+	 * bind the pages to the bound node, or interleave them over all nodes, before they are touched
+	 */
+	static void place(void* data, size_t len) {
+		if (nodes() < 2 || (bound() < 0 && numa() == local)) return;
+		const int bind = 2, interleave = 3; // MPOL_BIND and MPOL_INTERLEAVE of <numaif.h>
+		unsigned long mask = 0;
+		for (int n = 0; n < nodes() && n < 64; n++) if (bound() < 0 || bound() == n) mask |= 1ul << n;
+		if (::syscall(SYS_mbind, data, len, bound() >= 0 ? bind : interleave, &mask, 64, 0) != 0) config().failed = true;
+	}
+};
@@ -0,0 +1,192 @@
+/**
+ * Framework for Threes! and its variants (C++ 11)
+ * pool.h: Work-stealing thread pool for splitting a search across cores
+ *
+ * Author: Theory of Computer Games
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <memory>
+#include <ctime>
+#include "stopwatch.h"
+
+/**
+ * a relaxed atomic that can be copied, for counters and flags shared by the tasks of a search
+ * ++ is a relaxed load and store rather than an atomic increment, so concurrent counts may be lost
+ */
+template<class type>
+class relaxed {
+public:
+	relaxed(type v = type()) : v(v) {}
+	relaxed(const relaxed& r) : v(type(r)) {}
+	relaxed& operator =(const relaxed& r) { return operator =(type(r)); }
+	relaxed& operator =(type x) { v.store(x, std::memory_order_relaxed); return *this; }
+	operator type() const { return v.load(std::memory_order_relaxed); }
+	relaxed& operator ++() { return operator =(type(*this) + 1); }
+	type operator ++(int) { type x = *this; operator =(x + 1); return x; }
+private:
+	std::atomic<type> v;
+};
+
+/**
+ * a fixed set of workers, each with its own deque of tasks
+ *
+ * a task spawned by a thread is pushed to the back of its deque, and is popped from the back
+ * by the same thread (depth-first), or stolen from the front by another (breadth-first, i.e.,
+ * the larger subtrees); threads outside the pool share deque 0
+ *
+ * wait() runs tasks until the tasks of a group are done, so a task may spawn and wait
+ * for its own children without blocking a worker
+ *
+ * work() is the time the threads spent inside tasks, excluding the time they waited
+ * for children with nothing to run; work over wall time is the speedup of a search
+ */
+class pool {
+public:
+	/**
+	 * the tasks spawned together, and waited for together
+	 */
+	class group {
+	public:
+		group() : pending(0) {}
+	private:
+		friend class pool;
+		std::atomic<size_t> pending;
+	};
+
+	/**
+	 * threads includes the caller, i.e., threads - 1 workers are started
+	 */
+	pool(size_t threads) : queues(std::max<size_t>(threads, 1)), queued(0), busy(0), stop(false) {
+		for (size_t id = 1; id < queues.size(); id++) workers.emplace_back([this, id]() { serve(id); });
+	}
+	pool(const pool&) = delete;
+	~pool() {
+		{
+			std::lock_guard<std::mutex> guard(sleep);
+			stop = true;
+		}
+		wake.notify_all();
+		for (std::thread& worker : workers) worker.join();
+	}
+
+public:
+	size_t size() const { return queues.size(); }
+
+	void spawn(group& g, std::function<void()> fn) {
+		g.pending.fetch_add(1, std::memory_order_relaxed);
+		queue& q = queues[self()];
+		{
+			std::lock_guard<std::mutex> guard(q.lock);
+			q.tasks.push_back({ std::move(fn), &g });
+		}
+		queued.fetch_add(1, std::memory_order_release);
+		wake.notify_one();
+	}
+
+	void wait(group& g) {
+		time_t& idle = local().idle;
+		while (g.pending.load(std::memory_order_acquire)) {
+			task t;
+			if (take(self(), t)) {
+				run(t);
+			} else {
+				time_t start = stopwatch::nanosec();
+				std::this_thread::yield();
+				idle += stopwatch::nanosec() - start;
+			}
+		}
+	}
+
+	/**
+	 * the nanoseconds spent in tasks since the last call
+	 */
+	time_t work() { return busy.exchange(0); }
+
+private:
+	struct task {
+		std::function<void()> fn;
+		group* g;
+	};
+	struct queue {
+		std::mutex lock;
+		std::deque<task> tasks;
+	};
+
+	/**
+	 * the index of the calling thread in this pool, the nesting of its tasks, and its idle time
+	 */
+	struct identity {
+		const pool* owner = nullptr;
+		size_t id = 0;
+		unsigned depth = 0;
+		time_t idle = 0;
+	};
+	static identity& local() {
+		static thread_local identity who;
+		return who;
+	}
+	size_t self() const { return local().owner == this ? local().id : 0; }
+
+	bool take(size_t id, task& t) {
+		if (!queued.load(std::memory_order_acquire)) return false;
+		for (size_t k = 0; k < queues.size(); k++) {
+			queue& q = queues[(id + k) % queues.size()];
+			std::lock_guard<std::mutex> guard(q.lock);
+			if (q.tasks.empty()) continue;
+			if (k == 0) {
+				t = std::move(q.tasks.back());
+				q.tasks.pop_back();
+			} else {
+				t = std::move(q.tasks.front());
+				q.tasks.pop_front();
+			}
+			queued.fetch_sub(1, std::memory_order_relaxed);
+			return true;
+		}
+		return false;
+	}
+
+	void run(task& t) {
+		identity& who = local();
+		bool outer = who.depth++ == 0;
+		time_t start = stopwatch::nanosec(), idle = who.idle;
+		t.fn();
+		who.depth--;
+		if (outer) busy.fetch_add(stopwatch::nanosec() - start - (who.idle - idle), std::memory_order_relaxed);
+		t.g->pending.fetch_sub(1, std::memory_order_release);
+	}
+
+	void serve(size_t id) {
+		local().owner = this;
+		local().id = id;
+		while (true) {
+			task t;
+			if (take(id, t)) {
+				run(t);
+				continue;
+			}
+			std::unique_lock<std::mutex> guard(sleep);
+			if (stop) return;
+			wake.wait_for(guard, std::chrono::milliseconds(1), [this]() { return stop || queued.load(std::memory_order_acquire); });
+		}
+	}
+
+private:
+	std::vector<queue> queues;
+	std::vector<std::thread> workers;
+	std::atomic<size_t> queued;
+	std::atomic<time_t> busy;
+	std::mutex sleep;
+	std::condition_variable wake;
+	bool stop;
+};
@@ -0,0 +1,140 @@
+/**
+ * Framework for Threes! and its variants (C++ 11)
+ * profile.h: Compile-time switchable counters of the phases of the slider
+ *
+ * Author: Theory of Computer Games
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <atomic>
+#include <cstdint>
+#include "stopwatch.h"
+
+/**
+ * the calls, the cycles (time stamp counter ticks, see stopwatch::ticks), and the items of each phase
+ *
+ * build with -DPROFILE (make profile) to record them; otherwise PROFILE_SCOPE expands to
+ * nothing, and report() and dump() print nothing, so the hot path has no overhead
+ *
+ * the cycles of a phase include the phases it calls, e.g., search includes slide and lookup;
+ * items are the boards slid, the boards extracted or looked up, the chance nodes searched,
+ * and the table entries updated
+ */
+class profile {
+public:
+	enum phase { move, search, slide, extract, lookup, update, phases };
+
+	static const char* name(int p) {
+		static const char* names[] = { "move", "search", "slide", "extract", "lookup", "update" };
+		return names[p];
+	}
+
+	static bool enabled() {
+#ifdef PROFILE
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	/**
+	 * the counters of one phase, for the current block and in total
+	 */
+	struct counter {
+		std::atomic<uint64_t> calls, cycles, items;
+		uint64_t total_calls, total_cycles, total_items;
+		counter() : calls(0), cycles(0), items(0), total_calls(0), total_cycles(0), total_items(0) {}
+	};
+
+	static counter& at(phase p) {
+		static counter table[phases];
+		return table[p];
+	}
+
+	/**
+	 * record the cycles from construction to destruction as one call of the phase
+	 * the cycles of a call nested in the same phase (e.g., a recursive search) are not added again
+	 */
+	class scope {
+	public:
+		scope(phase p, uint64_t items = 1) : p(p), outer(nesting(p)++ == 0), start(stopwatch::ticks()) {
+			at(p).items.fetch_add(items, std::memory_order_relaxed);
+		}
+		~scope() {
+			counter& c = at(p);
+			c.calls.fetch_add(1, std::memory_order_relaxed);
+			nesting(p)--;
+			if (outer) c.cycles.fetch_add(stopwatch::ticks() - start, std::memory_order_relaxed);
+		}
+	private:
+		static unsigned& nesting(phase p) {
+			static thread_local unsigned depth[phases] = {};
+			return depth[p];
+		}
+		phase p;
+		bool outer;
+		uint64_t start;
+	};
+
+	/**
+	 * the counters of the block since the last report, which are then folded into the totals,
+	 * e.g., "prof = move 1000 x 52.1kc, search 91.0% (4.2k), slide 3.8% (16.8k), ..."
+	 */
+	static std::string report() {
+		if (!enabled()) return "";
+		uint64_t calls[phases], cycles[phases], items[phases];
+		for (int p = 0; p < phases; p++) {
+			counter& c = at(phase(p));
+			calls[p] = c.calls.exchange(0), cycles[p] = c.cycles.exchange(0), items[p] = c.items.exchange(0);
+			c.total_calls += calls[p], c.total_cycles += cycles[p], c.total_items += items[p];
+		}
+		std::stringstream ss;
+		ss << std::fixed << std::setprecision(1);
+		ss << "prof = " << name(move) << " " << calls[move] << " x " << scaled(cycles[move] / std::max<uint64_t>(calls[move], 1)) << "c";
+		for (int p = move + 1; p < phases; p++) {
+			if (!calls[p]) continue;
+			ss << ", " << name(p) << " " << (cycles[p] * 100.0 / std::max<uint64_t>(cycles[move], 1)) << "% (" << scaled(items[p]) << ")";
+		}
+		return ss.str();
+	}
+
+	/**
+	 * write the total counters (including the unreported block) as JSON
+	 */
+	static void dump(std::ostream& out) {
+		if (!enabled()) return;
+		out << "{\n\t\"phases\": {\n";
+		for (int p = 0; p < phases; p++) {
+			counter& c = at(phase(p));
+			out << "\t\t\"" << name(p) << "\": { ";
+			out << "\"calls\": " << (c.total_calls + c.calls) << ", ";
+			out << "\"cycles\": " << (c.total_cycles + c.cycles) << ", ";
+			out << "\"items\": " << (c.total_items + c.items) << " }" << (p + 1 < phases ? "," : "") << "\n";
+		}
+		out << "\t}\n}" << std::endl;
+	}
+
+private:
+	static std::string scaled(double v) {
+		const char* unit[] = { "", "k", "M", "G", "T" };
+		int u = 0;
+		for (; v >= 1000 && u < 4; u++) v /= 1000;
+		std::stringstream ss;
+		ss << std::fixed << std::setprecision(u ? 1 : 0) << v << unit[u];
+		return ss.str();
+	}
+};
+
+#ifdef PROFILE
+#define PROFILE_JOIN(a, b) a##b
+#define PROFILE_NAME(line) PROFILE_JOIN(profile_scope_, line)
+#define PROFILE_SCOPE(...) profile::scope PROFILE_NAME(__LINE__)(__VA_ARGS__)
+#else
+#define PROFILE_SCOPE(...)
+#endif
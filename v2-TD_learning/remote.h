@@ -0,0 +1,177 @@
+/**
+ * Framework for Threes! and its variants (C++ 11)
+ * remote.h: Connections of the actors, the learner, and the server over TCP
+ *
+ * Author: Theory of Computer Games
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <iostream>
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <cstdlib>
+#include <unistd.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+/**
+ * a connection that carries messages of (kind:32-bit) (length:64-bit) (payload), in host byte order,
+ * so the actors and the learner are expected to run on the same architecture
+ *
+ * an actor sends hello with its table sizes, then after each episode the updates of its moves,
+ * the record of the episode (episode::write), and waits for the reply of the learner:
+ * ack to continue, tables (the authoritative weights) to replace its own and continue, or stop
+ *
+ * a server connection carries text lines instead, see line()
+ */
+class channel {
+public:
+	enum kind : uint32_t { hello = 1, update = 2, record = 3, ack = 4, tables = 5, stop = 6 };
+
+	static const uint64_t max_message = uint64_t(1) << 26; // the largest hello, update, or record (64 MB)
+	static const size_t max_line = 1 << 16; // the longest request line of a server (64 KB)
+
+	channel(int fd = -1) : fd(fd) {}
+
+	/**
+	 * connect to host:port, or exit if it cannot
+	 */
+	static channel connect(const std::string& address) {
+		std::string host = address.substr(0, address.rfind(':')), port = address.substr(address.rfind(':') + 1);
+		addrinfo hints = {}, *list = nullptr;
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		if (::getaddrinfo(host.c_str(), port.c_str(), &hints, &list) == 0) {
+			for (addrinfo* ai = list; ai; ai = ai->ai_next) {
+				int fd = ::socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+				if (fd < 0) continue;
+				if (::connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+					::freeaddrinfo(list);
+					return configure(fd);
+				}
+				::close(fd);
+			}
+			::freeaddrinfo(list);
+		}
+		std::cerr << "remote: cannot connect to " << address << std::endl;
+		std::exit(-1);
+	}
+
+	/**
+	 * listen on the port of all interfaces, or exit if it cannot
+	 */
+	static int listen(unsigned port) {
+		int fd = ::socket(AF_INET6, SOCK_STREAM, 0), on = 1, off = 0;
+		sockaddr_in6 addr = {};
+		addr.sin6_family = AF_INET6;
+		addr.sin6_addr = in6addr_any;
+		addr.sin6_port = htons(port);
+		if (fd < 0 || ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) != 0
+				|| ::setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off)) != 0
+				|| ::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || ::listen(fd, 64) != 0) {
+			std::cerr << "remote: cannot listen on port " << port << std::endl;
+			std::exit(-1);
+		}
+		return fd;
+	}
+
+	static channel accept(int listener) {
+		int fd = ::accept(listener, nullptr, nullptr);
+		return fd >= 0 ? configure(fd) : channel();
+	}
+
+public:
+	bool is_open() const { return fd >= 0; }
+	int handle() const { return fd; }
+
+	void close() {
+		if (fd >= 0) ::close(fd);
+		fd = -1;
+	}
+
+	/**
+	 * send a message whose payload is written by the following put calls
+	 */
+	bool begin(uint32_t type, uint64_t length) {
+		char head[12];
+		std::memcpy(head, &type, 4);
+		std::memcpy(head + 4, &length, 8);
+		return put(head, sizeof(head));
+	}
+	bool put(const void* buf, size_t len) {
+		for (const char* p = static_cast<const char*>(buf); len; ) {
+			ssize_t n = ::send(fd, p, len, MSG_NOSIGNAL);
+			if (n <= 0) return false;
+			p += n, len -= n;
+		}
+		return true;
+	}
+	bool send(uint32_t type, const std::string& payload = "") {
+		return begin(type, payload.size()) && put(payload.data(), payload.size());
+	}
+
+	/**
+	 * receive the header of a message, whose payload is read by the following take calls
+	 * the caller checks the length, e.g., that of tables against the bytes of its own tables
+	 */
+	bool next(uint32_t& type, uint64_t& length) {
+		char head[12];
+		if (!take(head, sizeof(head))) return false;
+		std::memcpy(&type, head, 4);
+		std::memcpy(&length, head + 4, 8);
+		return true;
+	}
+	bool take(void* buf, size_t len) {
+		for (char* p = static_cast<char*>(buf); len; ) {
+			ssize_t n = ::recv(fd, p, len, 0);
+			if (n <= 0) return false;
+			p += n, len -= n;
+		}
+		return true;
+	}
+	/**
+	 * receive a whole message, or fail if its payload is longer than limit, in which case
+	 * the connection is to be closed since the rest of the stream cannot be trusted
+	 */
+	bool receive(uint32_t& type, std::string& payload, uint64_t limit = max_message) {
+		uint64_t length;
+		if (!next(type, length) || length > limit) return false;
+		payload.resize(length);
+		return take(&payload[0], length);
+	}
+
+	/**
+	 * receive a line of text without its newline (and carriage return), buffering what follows it,
+	 * or fail if the line is longer than max_line, in which case the connection is to be closed
+	 */
+	bool line(std::string& text) {
+		size_t end;
+		while ((end = pending.find('\n')) == std::string::npos) {
+			if (pending.size() > max_line) return false;
+			char buf[4096];
+			ssize_t n = ::recv(fd, buf, sizeof(buf), 0);
+			if (n <= 0) return false;
+			pending.append(buf, n);
+		}
+		text = pending.substr(0, end);
+		pending.erase(0, end + 1);
+		if (text.size() && text.back() == '\r') text.pop_back();
+		return true;
+	}
+
+private:
+	static channel configure(int fd) {
+		int on = 1; // the replies are small, and are waited for
+		::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+		return channel(fd);
+	}
+
+	int fd;
+	std::string pending; // the text received after the last line
+};
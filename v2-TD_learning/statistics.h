@@ -12,6 +12,9 @@
 #include <algorithm>
 #include <iostream>
 #include <sstream>
+#include <vector>
+#include <string>
+#include <functional>
 #include "board.h"
 #include "action.h"
 #include "episode.h"
@@ -23,13 +26,15 @@ public:
 	 * the block size of statistics
 	 * the limit of saving records
 	 *
-	 * note that total >= limit >= block
+	 * note that total >= limit, and total >= block
+	 * the summary of a block is folded from each episode as it closes, so the
+	 * limit only bounds the episodes kept in memory for saving
 	 */
 	statistics(size_t total, size_t block = 0, size_t limit = 0)
 		: total(total),
 		  block(block ? block : total),
 		  limit(limit ? limit : total),
-		  count(0) {}
+		  count(0), sink(nullptr) {}
 
 public:
 	/**
@@ -54,14 +59,29 @@ public:
 	 * '45.3%': 45.3% of the games terminated with 24-tiles as the largest tile
 	 */
 	void show(bool tstat = true, size_t blk = 0) const {
-		size_t num = std::min(data.size(), blk ?: block);
+		tally part;
+		const tally* sum = &current;
+		if (blk) { // walk back over the recorded episodes, e.g., for the summary of a loaded file
+			auto it = data.end();
+			for (size_t i = 0, num = std::min(data.size(), blk); i < num; i++) part.add(*(--it));
+			sum = &part;
+		}
+		show(*sum, tstat);
+	}
+
+protected:
+	/**
+	 * the counters of a block, folded from each episode as it closes
+	 */
+	struct tally {
+		size_t num = 0;
 		size_t stat[64] = { 0 };
 		size_t sop = 0, pop = 0, eop = 0;
 		time_t sdu = 0, pdu = 0, edu = 0;
 		board::score sum = 0, max = 0;
-		auto it = data.end();
-		for (size_t i = 0; i < num; i++) {
-			auto& ep = *(--it);
+
+		void add(const episode& ep) {
+			num++;
 			sum += ep.score();
 			max = std::max(ep.score(), max);
 			stat[*std::max_element(ep.state().begin(), ep.state().end())]++;
@@ -72,6 +92,14 @@ public:
 			pdu += ep.time(action::slide::type);
 			edu += ep.time(action::place::type);
 		}
+	};
+
+	void show(const tally& blk, bool tstat) const {
+		size_t num = blk.num;
+		const size_t* stat = blk.stat;
+		size_t sop = blk.sop, pop = blk.pop, eop = blk.eop;
+		time_t sdu = blk.sdu, pdu = blk.pdu, edu = blk.edu;
+		board::score sum = blk.sum, max = blk.max;
 
 		std::ios ff(nullptr);
 		ff.copyfmt(std::cout);
@@ -79,16 +107,20 @@ public:
 		std::cout << count << "\t";
 		std::cout << "avg = " << (sum / num) << ", ";
 		std::cout << "max = " << (max) << ", ";
-		std::cout << "ops = " << (sop * 1000.0 / sdu);
-		std::cout <<     " (" << (pop * 1000.0 / pdu);
-		std::cout <<      "|" << (eop * 1000.0 / edu) << ")";
+		std::cout << "ops = " << (sop * 1e9 / sdu);
+		std::cout <<     " (" << (pop * 1e9 / pdu);
+		std::cout <<      "|" << (eop * 1e9 / edu) << ")";
+		for (const reporter& note : notes) {
+			std::string text = note();
+			if (text.size()) std::cout << ", " << text;
+		}
 		std::cout << std::endl;
 		std::cout.copyfmt(ff);
 
 		if (!tstat) return;
 		for (size_t t = 0, c = 0; c < num; c += stat[t++]) {
 			if (stat[t] == 0) continue;
-			size_t accu = std::accumulate(std::begin(stat) + t, std::end(stat), size_t(0));
+			size_t accu = std::accumulate(stat + t, stat + 64, size_t(0));
 			std::cout << "\t" << board::itot(t); // type
 			std::cout << "\t" << (accu * 100.0 / num) << "%"; // win rate
 			std::cout << "\t" "(" << (stat[t] * 100.0 / num) << "%" ")"; // percentage of ending
@@ -97,6 +129,16 @@ public:
 		std::cout << std::endl;
 	}
 
+public:
+	/**
+	 * attach a reporter, whose text (e.g., "tt = 75.0% (3|1)") is appended to
+	 * the summary line of each block; a reporter returns the counters of its block
+	 */
+	typedef std::function<std::string()> reporter;
+	void attach(const reporter& note) {
+		notes.push_back(note);
+	}
+
 	void summary() const {
 		show(true, data.size());
 	}
@@ -113,7 +155,39 @@ public:
 
 	void close_episode(const std::string& flag = "") {
 		data.back().close_episode(flag);
-		if (count % block == 0) show();
+		fold();
+	}
+
+	/**
+	 * append an episode that was played and closed elsewhere, e.g., by a worker thread
+	 */
+	void append(episode&& ep) {
+		if (count++ >= limit) data.pop_front();
+		data.push_back(std::move(ep));
+		fold();
+	}
+
+	/**
+	 * fold the last closed episode into the counters of the block, and
+	 * stream it; the block is shown and its counters are reset at its end
+	 */
+	void fold() {
+		current.add(data.back());
+		if (sink) data.back().write(*sink);
+		if (count % block == 0) show(), current = {};
+	}
+
+	/**
+	 * write the episodes to out in the binary format (magic "THREESEP", version, then
+	 * the records of episode::write), starting with the header and the recorded episodes,
+	 * then appending each episode as it closes, so that the limit only bounds the memory
+	 */
+	void stream(std::ostream& out) {
+		uint32_t ver = version;
+		out.write(signature(), 8);
+		out.write(reinterpret_cast<const char*>(&ver), sizeof(ver));
+		for (const episode& rec : data) rec.write(out);
+		sink = &out;
 	}
 
 	episode& at(size_t i) {
@@ -133,13 +207,32 @@ public:
 		for (const episode& rec : stat.data) out << rec << std::endl;
 		return out;
 	}
+	/**
+	 * read the episodes in either the text format or the binary format (see stream)
+	 */
 	friend std::istream& operator >>(std::istream& in, statistics& stat) {
-		for (std::string line; std::getline(in, line) && line.size(); ) {
-			stat.data.emplace_back();
-			std::stringstream(line) >> stat.data.back();
+		char magic[8] = {};
+		auto start = in.tellg();
+		uint32_t ver = 0;
+		if (in.read(magic, 8) && std::equal(magic, magic + 8, signature())) {
+			if (!in.read(reinterpret_cast<char*>(&ver), sizeof(ver)) || ver < 1 || ver > version) {
+				std::cerr << "statistics: unsupported version " << ver << std::endl;
+				std::exit(-1);
+			}
+			for (episode rec; rec.read(in, ver); ) stat.data.push_back(std::move(rec));
+			if (in.gcount() || !in.eof()) std::cerr << "statistics: the last record is truncated" << std::endl;
+		} else {
+			in.clear();
+			in.seekg(start);
+			for (std::string line; std::getline(in, line) && line.size(); ) {
+				stat.data.emplace_back();
+				std::stringstream(line) >> stat.data.back();
+			}
 		}
 		stat.total = std::max(stat.total, stat.data.size());
 		stat.count = stat.data.size();
+		stat.current = {};
+		for (size_t i = stat.count - (stat.block ? stat.count % stat.block : 0); i < stat.count; i++) stat.current.add(stat.data[i]);
 		return in;
 	}
 
@@ -149,4 +242,10 @@ private:
 	size_t limit;
 	size_t count;
 	std::deque<episode> data;
+	std::vector<reporter> notes;
+	std::ostream* sink;
+	tally current;
+
+	static const uint32_t version = 2;
+	static const char* signature() { return "THREESEP"; }
 };
@@ -0,0 +1,97 @@
+/**
+ * Framework for Threes! and its variants (C++ 11)
+ * stopwatch.h: Low-overhead nanosecond clock for timing moves
+ *
+ * Author: Theory of Computer Games
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <chrono>
+#include <ctime>
+#include <cstdint>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#include <cpuid.h>
+#endif
+
+/**
+ * a monotonic clock in nanoseconds, read from the time stamp counter if the processor
+ * has an invariant one (calibrated once against the steady clock), or from the steady clock
+ *
+ * millisec() is the wall clock, which is only used to stamp the episodes in the logs
+ *
+ * the time stamp counter is only read on x86; elsewhere tsc always falls back to steady
+ */
+class stopwatch {
+public:
+	enum source { steady = 0, tsc = 1 };
+
+	/**
+	 * select the source of nanosec(); tsc falls back to steady if it is not invariant
+	 * it should be selected before any move is timed
+	 */
+	static void select(source src) {
+		config().src = (src == tsc && invariant()) ? tsc : steady;
+		if (config().src == tsc) calibrate();
+	}
+	static source selected() { return config().src; }
+
+	static time_t nanosec() {
+		const state& s = config();
+		if (s.src == tsc) return s.base + time_t(int64_t(ticks() - s.start) * s.scale);
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+	static time_t millisec() {
+		auto now = std::chrono::system_clock::now().time_since_epoch();
+		return std::chrono::duration_cast<std::chrono::milliseconds>(now).count();
+	}
+
+	/**
+	 * the time stamp counter, or 0 where there is none
+	 */
+	static uint64_t ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+		return __rdtsc();
+#else
+		return 0;
+#endif
+	}
+
+private:
+	struct state {
+		source src = steady;
+		uint64_t start = 0; // the counter at base
+		time_t base = 0; // the steady clock at start
+		double scale = 1; // nanoseconds per tick
+	};
+	static state& config() { static state s; return s; }
+
+	static bool invariant() {
+#if defined(__x86_64__) || defined(__i386__)
+		unsigned eax, ebx, ecx, edx;
+		if (!__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) || eax < 0x80000007) return false;
+		__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+		return edx & (1u << 8);
+#else
+		return false;
+#endif
+	}
+
+	/**
+	 * measure the ticks per nanosecond over a few milliseconds of the steady clock
+	 */
+	static void calibrate() {
+		using std::chrono::steady_clock;
+		auto t0 = steady_clock::now();
+		uint64_t c0 = ticks();
+		while (steady_clock::now() - t0 < std::chrono::milliseconds(5));
+		auto t1 = steady_clock::now();
+		uint64_t c1 = ticks();
+		state& s = config();
+		s.scale = std::chrono::duration<double, std::nano>(t1 - t0).count() / double(c1 - c0);
+		s.start = c1;
+		s.base = std::chrono::duration_cast<std::chrono::nanoseconds>(t1.time_since_epoch()).count();
+	}
+};
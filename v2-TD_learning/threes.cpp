@@ -11,20 +11,296 @@
 #include <fstream>
 #include <iterator>
 #include <string>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <map>
+#include <vector>
+#include <random>
+#include <sstream>
 #include "board.h"
 #include "action.h"
 #include "agent.h"
 #include "episode.h"
 #include "statistics.h"
+#include "stopwatch.h"
+#include "profile.h"
+#include "remote.h"
+#include "batch.h"
 
-int main(int argc, const char* argv[]) {
-	std::cout << "Threes! Demo: ";
-	std::copy(argv, argv + argc, std::ostream_iterator<const char*>(std::cout, " "));
-	std::cout << std::endl << std::endl;
+/**
+ * let the slider and the placer take turns until the episode ends
+ * return the agent who made the last move
+ */
+agent& play(episode& game, agent& slide, agent& place) {
+	while (true) {
+		agent& who = game.take_turns(slide, place);
+		action move = who.take_action(game.state());
+//		std::cerr << game.state() << "#" << game.step() << " " << who.name() << ": " << move << std::endl;
+		if (game.apply_action(move) != true) break;
+		if (who.check_for_win(game.state())) break;
+	}
+	return game.last_turns(slide, place);
+}
+
+/**
+ * the hello of an actor, or what the learner expects: the table count (32-bit), then their sizes (64-bit)
+ */
+std::string greeting(const std::vector<weight>& net) {
+	uint32_t count = net.size();
+	std::string msg(reinterpret_cast<const char*>(&count), sizeof(count));
+	for (const weight& w : net) {
+		uint64_t size = w.size();
+		msg.append(reinterpret_cast<const char*>(&size), sizeof(size));
+	}
+	return msg;
+}
+
+/**
+ * own the tables of the slider, apply the updates of the remote actors, and fold their episodes into stats
+ * until it is finished; each actor gets the tables after every sync of its episodes, and stop afterward
+ */
+void learn(unsigned port, tdLearning_slider& learner, statistics& stats, size_t sync) {
+	std::vector<weight>& net = learner.tables();
+	const std::string expected = greeting(net);
+	uint64_t bytes = 0;
+	for (const weight& w : net) bytes += w.size() * sizeof(weight::type);
+	struct peer {
+		channel link;
+		size_t episodes;
+		bool greeted; // whether its hello is accepted, before which its other messages are refused
+	};
+	std::vector<peer> peers;
+	struct traffic {
+		size_t actors = 0, updates = 0;
+	};
+	auto seen = std::make_shared<traffic>(); // kept by the reporter after the learner returns
+	stats.attach([seen]() {
+		size_t updates = seen->updates;
+		seen->updates = 0;
+		return "actors = " + std::to_string(seen->actors) + ", updates = " + std::to_string(updates);
+	});
+
+	// serve the next message of an actor, return false if its connection is to be closed
+	auto serve = [&](peer& p) -> bool {
+		uint32_t type;
+		std::string msg;
+		if (!p.link.receive(type, msg)) return false;
+		if (type == channel::hello) {
+			if (msg == expected) {
+				p.greeted = true;
+				return true;
+			}
+			std::cerr << "learner: the tables of an actor differ" << std::endl;
+			p.link.send(channel::stop);
+			return false;
+		} else if (!p.greeted) {
+			std::cerr << "learner: an actor sent a message before its hello" << std::endl;
+			return false;
+		} else if (type == channel::update) { // the indices per update (32-bit), then (delta:float) (indices:32-bit) of each
+			// the whole message is checked before it is applied: n must be the feature count, and every index in its table
+			uint32_t n;
+			if (msg.size() < sizeof(n)) return false;
+			std::memcpy(&n, msg.data(), sizeof(n));
+			size_t width = sizeof(float) + n * sizeof(uint32_t);
+			if (n != net.size() * pattern::isomorphisms || (msg.size() - sizeof(n)) % width) {
+				std::cerr << "learner: an actor sent a malformed update" << std::endl;
+				return false;
+			}
+			for (const char* at = msg.data() + sizeof(n); at < msg.data() + msg.size(); at += width) {
+				for (size_t i = 0; i < n; i++) {
+					uint32_t index;
+					std::memcpy(&index, at + sizeof(float) + i * sizeof(index), sizeof(index));
+					if (index >= net[i % net.size()].size()) {
+						std::cerr << "learner: an actor sent an update out of the tables" << std::endl;
+						return false;
+					}
+				}
+			}
+			for (const char* at = msg.data() + sizeof(n); at < msg.data() + msg.size(); at += width, seen->updates++) {
+				float delta;
+				std::memcpy(&delta, at, sizeof(delta));
+				for (size_t i = 0; i < n; i++) {
+					uint32_t index;
+					std::memcpy(&index, at + sizeof(delta) + i * sizeof(index), sizeof(index));
+					net[i % net.size()].update(index, delta);
+				}
+			}
+			return true;
+		} else if (type == channel::record) {
+			std::istringstream in(msg);
+			episode game;
+			if (!game.read(in)) return false;
+			if (!stats.is_finished()) stats.append(std::move(game));
+			if (stats.is_finished()) {
+				p.link.send(channel::stop);
+				return false;
+			}
+			if (!sync || ++p.episodes % sync) return p.link.send(channel::ack);
+			bool ok = p.link.begin(channel::tables, bytes);
+			for (size_t i = 0; ok && i < net.size(); i++) ok = p.link.put(net[i].data(), net[i].size() * sizeof(weight::type));
+			return ok;
+		}
+		return false;
+	};
+
+	int listener = channel::listen(port);
+	std::cerr << "learner: listening on port " << port << std::endl;
+	while (!stats.is_finished() || peers.size()) {
+		bool open = !stats.is_finished();
+		std::vector<pollfd> fds;
+		if (open) fds.push_back({ listener, POLLIN, 0 });
+		for (peer& p : peers) fds.push_back({ p.link.handle(), POLLIN, 0 });
+		if (::poll(fds.data(), fds.size(), -1) < 0) continue;
+		for (size_t k = open; k < fds.size(); k++) {
+			peer& p = peers[k - open];
+			if ((fds[k].revents & (POLLIN | POLLHUP | POLLERR)) && !serve(p)) p.link.close();
+		}
+		peers.erase(std::remove_if(peers.begin(), peers.end(), [](const peer& p) { return !p.link.is_open(); }), peers.end());
+		if (open && (fds[0].revents & POLLIN)) {
+			channel link = channel::accept(listener);
+			if (link.is_open()) peers.push_back({ link, 0, false });
+		}
+		seen->actors = peers.size();
+	}
+	::close(listener);
+}
+
+/**
+ * play episodes with a local copy of the tables, and send their updates and records to
+ * the learner at address, replacing the tables whenever the learner sends them, until it stops
+ */
+void act(const std::string& address, tdLearning_slider& slide, random_placer& place) {
+	std::vector<weight>& net = slide.tables();
+	uint64_t bytes = 0;
+	for (const weight& w : net) bytes += w.size() * sizeof(weight::type);
+	std::string batch;
+	slide.publish = [&batch](const size_t* index, size_t n, float delta) {
+		if (batch.empty()) {
+			uint32_t width = n;
+			batch.append(reinterpret_cast<const char*>(&width), sizeof(width));
+		}
+		batch.append(reinterpret_cast<const char*>(&delta), sizeof(delta));
+		for (size_t i = 0; i < n; i++) {
+			uint32_t at = index[i];
+			batch.append(reinterpret_cast<const char*>(&at), sizeof(at));
+		}
+	};
+
+	channel link = channel::connect(address);
+	bool ok = link.send(channel::hello, greeting(net));
+	size_t games = 0, syncs = 0;
+	while (ok) {
+		slide.open_episode("~:" + place.name());
+		place.open_episode(slide.name() + ":~");
+
+		episode game;
+		game.open_episode(slide.name() + ":" + place.name());
+		agent& win = play(game, slide, place);
+		game.close_episode(win.name());
+
+		slide.close_episode(win.name());
+		place.close_episode(win.name());
+		games++;
+
+		std::ostringstream record;
+		game.write(record);
+		ok = (batch.empty() || link.send(channel::update, batch)) && link.send(channel::record, record.str());
+		batch.clear();
+
+		uint32_t type;
+		uint64_t length;
+		if (!ok || !link.next(type, length) || type == channel::stop) break;
+		if (type == channel::tables) {
+			ok = length == bytes;
+			for (size_t i = 0; ok && i < net.size(); i++) ok = link.take(net[i].data(), net[i].size() * sizeof(weight::type));
+			syncs++;
+		} else {
+			ok = type == channel::ack;
+		}
+	}
+	link.close();
+	std::cerr << "actor: " << games << " episodes played, " << syncs << " tables received";
+	std::cerr << (ok ? "" : ", the connection to " + address + " is lost") << std::endl;
+}
+
+/**
+ * the answer of the slider to a request, which is either
+ *   "board t0 t1 ... t15 h [b1 b2 b3]": the tiles (0, 1, 2, 3, 6, ...), the hint, and the counts of 1, 2, 3 in the bag, or
+ *   "episode m0 m1 ...": the moves from the initial state in the text encoding of the episodes (with or without
+ *   the spaces, rewards, and times), from which the hint, the last slide, and the bag are exact
+ * the answer is the slide (e.g., "#U"), "??" if there is no legal one, or "error: ..." for a malformed request
+ */
+std::string answer(agent& slide, const std::string& request) {
+	std::istringstream in(request);
+	std::string kind;
+	in >> kind;
+	board state;
+	if (kind == "board") {
+		unsigned hint = 0, count[3] = { 1, 1, 1 };
+		if (!(in >> state >> hint) || hint < 1 || hint > 3) return "error: expect 16 tiles and a hint";
+		if (!(in >> std::ws).eof()) { // the bag holds at most one of each tile, and is refilled once empty
+			for (unsigned& n : count) in >> n;
+			if (!in || !(in >> std::ws).eof()) return "error: expect 3 bag counts after the hint";
+			if (count[0] > 1 || count[1] > 1 || count[2] > 1 || count[0] + count[1] + count[2] == 0)
+				return "error: the bag counts must be 0 or 1, and not all 0";
+		}
+		state.hint(hint);
+		for (board::cell t = 1; t <= 3; t++) state.bag(t, count[t - 1]);
+	} else if (kind == "episode") {
+		for (in >> std::ws; in.peek() != EOF; in >> std::ws) {
+			action move;
+			if (!(in >> move) || move.apply(state) == -1) return "error: cannot apply the moves";
+			if (in.peek() == '[') in.ignore(request.size(), ']');
+			if (in.peek() == '(') in.ignore(request.size(), ')');
+		}
+	} else {
+		return "error: unknown request " + kind;
+	}
+	std::ostringstream out;
+	slide.open_episode(); // the requests are unrelated, so nothing (e.g., the afterstate of the last one) is carried over
+	out << slide.take_action(state);
+	return out.str();
+}
+
+/**
+ * load the slider once, and answer the requests (see answer), one per line, until "quit", from
+ * stdin to stdout with "stdio", or from the connections to a port, each served by its own fork
+ * of the slider on its own thread, which share the tables
+ *
+ * the tables are never changed by the requests, since the slider of --serve is loaded with alpha=0
+ */
+void serve(const std::string& where, tdLearning_slider& slide) {
+	if (where == "stdio") {
+		for (std::string line; std::getline(std::cin, line) && line != "quit"; ) {
+			if (line.size()) std::cout << answer(slide, line) << std::endl;
+		}
+		return;
+	}
+	unsigned port = std::stoul(where);
+	int listener = channel::listen(port);
+	std::cerr << "server: listening on port " << port << std::endl;
+	while (true) {
+		channel link = channel::accept(listener);
+		if (!link.is_open()) continue;
+		std::thread([link, &slide]() mutable {
+			tdLearning_slider worker(slide);
+			for (std::string line; link.line(line) && line != "quit"; ) {
+				if (line.empty()) continue;
+				std::string reply = answer(worker, line) + "\n";
+				if (!link.put(reply.data(), reply.size())) break;
+			}
+			link.close();
+		}).detach();
+	}
+}
 
-	size_t total = 1000, block = 0, limit = 0;
-	std::string slide_args, place_args;
-	std::string load_path, save_path;
+int main(int argc, const char* argv[]) {
+	size_t total = 1000, block = 0, limit = 0, threads = 1, sync = 100, batch = 0;
+	bool evaluate = false;
+	unsigned port = 0;
+	std::string slide_args, place_args, actor, server;
+	std::string load_path, save_path, format = "text", profile_path;
 	for (int i = 1; i < argc; i++) {
 		std::string arg = argv[i];
 		auto match_arg = [&](std::string flag) -> bool {
@@ -41,6 +317,20 @@ int main(int argc, const char* argv[]) {
 			block = std::stoull(next_opt());
 		} else if (match_arg("limit")) {
 			limit = std::stoull(next_opt());
+		} else if (match_arg("threads")) {
+			threads = std::stoull(next_opt());
+		} else if (match_arg("batch")) {
+			batch = std::stoull(next_opt());
+		} else if (match_arg("evaluate")) {
+			evaluate = true;
+		} else if (match_arg("learner")) {
+			port = std::stoul(next_opt());
+		} else if (match_arg("actor")) {
+			actor = next_opt();
+		} else if (match_arg("sync")) {
+			sync = std::stoull(next_opt());
+		} else if (match_arg("serve")) {
+			server = next_opt();
 		} else if (match_arg("slide") || match_arg("play")) {
 			slide_args = next_opt();
 		} else if (match_arg("place") || match_arg("env")) {
@@ -49,20 +339,106 @@ int main(int argc, const char* argv[]) {
 			load_path = next_opt();
 		} else if (match_arg("save")) {
 			save_path = next_opt();
+		} else if (match_arg("format")) {
+			format = next_opt();
+		} else if (match_arg("timer")) {
+			stopwatch::select(next_opt() == "tsc" ? stopwatch::tsc : stopwatch::steady);
+		} else if (match_arg("sample")) {
+			episode::sample(std::stoull(next_opt()));
+		} else if (match_arg("profile")) {
+			profile_path = next_opt();
 		}
 	}
 
-	statistics stats(total, block, limit);
+	// the answers of --serve=stdio go to stdout alone
+	std::ostream& banner = server == "stdio" ? std::cerr : std::cout;
+	banner << "Threes! Demo: ";
+	std::copy(argv, argv + argc, std::ostream_iterator<const char*>(banner, " "));
+	banner << std::endl << std::endl;
+
+	// the episodes are kept in memory only to be saved in the text format at the end; otherwise (no --save, or
+	// the binary format, which is streamed into --save) only the episode being played is kept unless --limit is given
+	bool binary = (format == "binary");
+	statistics stats(total, block, limit ?: (save_path.size() && !binary ? total : 1));
 
 	if (load_path.size()) {
-		std::ifstream in(load_path, std::ios::in);
+		std::ifstream in(load_path, std::ios::in | std::ios::binary);
 		in >> stats;
 		in.close();
 		if (stats.is_finished()) stats.summary();
 	}
 
+	std::ofstream log;
+	if (binary && save_path.size()) {
+		log.open(save_path, std::ios::out | std::ios::binary | std::ios::trunc);
+		stats.stream(log);
+	}
+
+	if (server.size()) slide_args += " alpha=0"; // a server answers the requests without learning from them
 	tdLearning_slider slide(slide_args);
 	random_placer place(place_args);
+	stats.attach([&]() { return slide.report(); });
+	if (profile::enabled()) stats.attach(profile::report);
+
+	if (server.size()) {
+		serve(server, slide);
+		return 0;
+	}
+	if (actor.size()) {
+		act(actor, slide, place);
+		return 0;
+	}
+	if (port) learn(port, slide, stats, sync);
+
+	if (batch) {
+		// the games are played in lockstep by the main thread, and are those of --evaluate with depth=0
+		unsigned seed = place_args.find("seed=") != std::string::npos ? std::stoul(place.property("seed")) : std::random_device()();
+		std::cerr << "batch = " << batch << " with seed = " << seed << std::endl;
+		size_t first = stats.step(), remain = stats.is_finished() ? 0 : total - stats.step();
+		lockstep(batch, slide, place_args, seed).run(stats, first, remain);
+	} else if (threads > 1 || evaluate) {
+		// each worker plays its own episodes with its own placer,
+		// shares the tables of the slider, and merges the finished episodes into stats
+		// with --evaluate, the placer of game g is seeded by (seed, g), and the episodes are merged in game order,
+		// so the games and the log do not depend on the number of threads (as long as the slider does not learn)
+		unsigned seed = place_args.find("seed=") != std::string::npos ? std::stoul(place.property("seed")) : std::random_device()();
+		if (evaluate) std::cerr << "evaluate with seed = " << seed << std::endl;
+		size_t first = stats.step(), remain = stats.is_finished() ? 0 : total - stats.step();
+		std::atomic<size_t> issued(0);
+		std::mutex lock;
+		std::map<size_t, episode> pending; // the finished games that wait for the earlier ones
+		size_t merged = 0;
+		std::vector<std::thread> workers;
+		for (size_t id = 0; id < threads; id++) {
+			workers.emplace_back([&, id]() {
+				tdLearning_slider slide_worker(slide);
+				random_placer place_worker(place_args + " seed=" + std::to_string(seed + id));
+				for (size_t g; (g = issued++) < remain; ) {
+					if (evaluate) place_worker.seed(random_agent::seed(seed, first + g));
+					slide_worker.open_episode("~:" + place_worker.name());
+					place_worker.open_episode(slide_worker.name() + ":~");
+
+					episode game;
+					game.open_episode(slide_worker.name() + ":" + place_worker.name());
+					agent& win = play(game, slide_worker, place_worker);
+					game.close_episode(win.name());
+
+					slide_worker.close_episode(win.name());
+					place_worker.close_episode(win.name());
+
+					std::lock_guard<std::mutex> guard(lock);
+					if (!evaluate) {
+						stats.append(std::move(game));
+						continue;
+					}
+					pending.emplace(g, std::move(game));
+					for (auto it = pending.begin(); it != pending.end() && it->first == merged; it = pending.erase(it), merged++)
+						stats.append(std::move(it->second));
+				}
+			});
+		}
+		for (std::thread& worker : workers) worker.join();
+	}
 
 	while (!stats.is_finished()) {
 //		std::cerr << "======== Game " << stats.step() << " ========" << std::endl;
@@ -70,26 +446,23 @@ int main(int argc, const char* argv[]) {
 		place.open_episode(slide.name() + ":~");
 
 		stats.open_episode(slide.name() + ":" + place.name());
-		episode& game = stats.back();
-		while (true) {
-			agent& who = game.take_turns(slide, place);
-			action move = who.take_action(game.state());
-//			std::cerr << game.state() << "#" << game.step() << " " << who.name() << ": " << move << std::endl;
-			if (game.apply_action(move) != true) break;
-			if (who.check_for_win(game.state())) break;
-		}
-		agent& win = game.last_turns(slide, place);
+		agent& win = play(stats.back(), slide, place);
 		stats.close_episode(win.name());
 
 		slide.close_episode(win.name());
 		place.close_episode(win.name());
 	}
 
-	if (save_path.size()) {
+	if (save_path.size() && !binary) {
 		std::ofstream out(save_path, std::ios::out | std::ios::trunc);
 		out << stats;
 		out.close();
 	}
 
+	if (profile::enabled()) { // built with make profile
+		std::ofstream out(profile_path.size() ? profile_path : "profile.json", std::ios::out | std::ios::trunc);
+		profile::dump(out);
+	}
+
 	return 0;
 }
@@ -0,0 +1,110 @@
+/**
+ * Framework for Threes! and its variants (C++ 11)
+ * transposition.h: Fixed-size lossy transposition table for searching afterstates
+ *
+ * Author: Theory of Computer Games
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <cstring>
+#include "bitboard.h"
+#include "pool.h"
+
+/**
+ * direct-mapped table of searched values, keyed by the packed tiles and info
+ * (hint, last action, and bag) of a board
+ *
+ * a slot keeps the latest value stored into it, together with its search depth
+ * and whether the value is exact or a bound;
+ * a probe hits if the key matches, and the stored depth is at least the requested one
+ *
+ * clear() starts a new generation in O(1), invalidating all previous entries
+ *
+ * the table may be shared by the tasks of a parallel search without locks: a slot keeps
+ * its tiles xor its data, so a slot torn by concurrent stores fails the key check (and misses)
+ */
+class transposition {
+public:
+	transposition(unsigned bits = 0) : hits(0), misses(0), bits(bits), generation(1) {
+		if (bits) slots.resize(size_t(1) << bits);
+	}
+
+public:
+	bool enabled() const { return bits != 0; }
+	size_t size() const { return slots.size(); }
+
+	/**
+	 * find the value of the board searched with at least the given depth
+	 * a value cut outside its window [lower, upper] is only a bound, and is
+	 * returned only if it is also outside the requested window
+	 */
+	bool find(const bitboard& b, unsigned depth, float lower, float upper, float& value) {
+		if (!bits) return false;
+		const entry& e = slots[hash(b)];
+		uint64_t data = e.data;
+		uint32_t info = uint32_t(data);
+		if ((e.check ^ data) == b.bits() && (info & key_mask) == key(b) && (info >> 20 & 0x0fu) >= depth) {
+			unsigned type = info >> 24 & 0b11;
+			float stored;
+			uint32_t bits = uint32_t(data >> 32);
+			std::memcpy(&stored, &bits, sizeof(stored));
+			if (type == exact || (type == lower_bound && stored >= upper) || (type == upper_bound && stored <= lower)) {
+				value = stored;
+				hits++;
+				return true;
+			}
+		}
+		misses++;
+		return false;
+	}
+
+	/**
+	 * store the value of the board searched with the given depth and window
+	 */
+	void store(const bitboard& b, unsigned depth, float lower, float upper, float value) {
+		if (!bits) return;
+		entry& e = slots[hash(b)];
+		unsigned type = value <= lower ? upper_bound : (value >= upper ? lower_bound : exact);
+		uint32_t bits;
+		std::memcpy(&bits, &value, sizeof(bits));
+		uint64_t data = (key(b) | (std::min(depth, 15u) << 20) | (type << 24)) | (uint64_t(bits) << 32);
+		e.data = data;
+		e.check = b.bits() ^ data;
+	}
+
+	void clear() {
+		if (++generation < 64) return;
+		for (entry& e : slots) e = {};
+		generation = 1;
+	}
+
+public:
+	relaxed<size_t> hits;
+	relaxed<size_t> misses;
+
+private:
+	struct entry {
+		uint64_t check; // the tiles xor data
+		uint64_t data; // (value:32-bit) (generation:6-bit) (bound:2-bit) (depth:4-bit) (board info:20-bit)
+	};
+	enum bound { exact = 0, lower_bound = 1, upper_bound = 2 };
+	static const uint32_t key_mask = 0xfc0fffffu;
+
+	uint32_t key(const bitboard& b) const {
+		return (b.info() & 0xfffffu) | (generation << 26);
+	}
+	size_t hash(const bitboard& b) const {
+		uint64_t h = (b.bits() ^ (b.info() * 0x9e3779b97f4a7c15ull)) * 0xff51afd7ed558ccdull;
+		return (h ^ (h >> 29)) >> (64 - bits);
+	}
+
+private:
+	unsigned bits;
+	uint32_t generation;
+	std::vector<entry> slots;
+};
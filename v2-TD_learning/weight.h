@@ -11,39 +11,145 @@
 #include <iostream>
 #include <vector>
 #include <utility>
+#include <memory>
+#include <algorithm>
+#include <cstdint>
+#include <cmath>
+#include "pages.h"
 
+/**
+ * a table either owns its entries on the heap, or refers to an external region
+ * (e.g., a table inside a memory-mapped file) that is kept alive by an owner
+ *
+ * a large table is mapped with the huge-page and NUMA policies of pages.h if any is selected
+ */
 class weight {
 public:
 	typedef float type;
 
 public:
-	weight() {}
-	weight(size_t len) : value(len) {}
-	weight(weight&& f) : value(std::move(f.value)) {}
-	weight(const weight& f) = default;
+	weight() : value(nullptr), length(0) {}
+	weight(size_t len) : weight() { allocate(len); }
+	weight(type* data, size_t len, const std::shared_ptr<void>& owner) : value(data), length(len), block(owner) {}
+	weight(weight&& f) noexcept : value(f.value), length(f.length), block(std::move(f.block)) { f.value = nullptr; f.length = 0; }
+	weight(const weight& f) : weight(f.length) { std::copy(f.value, f.value + f.length, value); }
 
-	weight& operator =(const weight& f) = default;
+	weight& operator =(const weight& f) { if (this != &f) *this = weight(f); return *this; }
+	weight& operator =(weight&& f) noexcept {
+		std::swap(value, f.value);
+		std::swap(length, f.length);
+		std::swap(block, f.block);
+		return *this;
+	}
 	type& operator[] (size_t i) { return value[i]; }
 	const type& operator[] (size_t i) const { return value[i]; }
-	size_t size() const { return value.size(); }
+	size_t size() const { return length; }
+	type* data() { return value; }
+	const type* data() const { return value; }
+
+	/**
+	 * add delta to an entry with relaxed atomic loads and stores, without locking
+	 * concurrent updates of the same entry may be lost, which TD learning tolerates
+	 */
+	void update(size_t i, double delta) {
+		type v;
+		__atomic_load(&value[i], &v, __ATOMIC_RELAXED);
+		v += delta;
+		__atomic_store(&value[i], &v, __ATOMIC_RELAXED);
+	}
 
 public:
 	friend std::ostream& operator <<(std::ostream& out, const weight& w) {
-		auto& value = w.value;
-		uint64_t size = value.size();
+		uint64_t size = w.size();
 		out.write(reinterpret_cast<const char*>(&size), sizeof(uint64_t));
-		out.write(reinterpret_cast<const char*>(value.data()), sizeof(type) * size);
+		out.write(reinterpret_cast<const char*>(w.data()), sizeof(type) * size);
 		return out;
 	}
 	friend std::istream& operator >>(std::istream& in, weight& w) {
-		auto& value = w.value;
 		uint64_t size = 0;
 		in.read(reinterpret_cast<char*>(&size), sizeof(uint64_t));
-		value.resize(size);
-		in.read(reinterpret_cast<char*>(value.data()), sizeof(type) * size);
+		w.allocate(size);
+		in.read(reinterpret_cast<char*>(w.data()), sizeof(type) * size);
 		return in;
 	}
 
 protected:
-	std::vector<type> value;
+	void allocate(size_t len) {
+		length = len;
+		if (pages::mapped(sizeof(type) * len)) {
+			value = static_cast<type*>(pages::allocate(sizeof(type) * len, block));
+			return;
+		}
+		value = len ? new type[len]() : nullptr;
+		block.reset(value, std::default_delete<type[]>());
+	}
+
+protected:
+	type* value;
+	size_t length;
+	std::shared_ptr<void> block;
+};
+
+/**
+ * a table of 16-bit fixed-point entries with a per-table scale, for agents that only evaluate
+ * an entry is worth (stored value * scale), where the scale maps the largest magnitude to 32767
+ *
+ * one spare entry follows the table, so that a 32-bit gather of the last entry stays in bounds;
+ * the entries are never written after quantization, so copies share them
+ */
+class quantized {
+public:
+	typedef int16_t type;
+	static const int limit = 32767;
+
+public:
+	quantized() : value(nullptr), length(0), factor(1) {}
+	quantized(const weight& w) : quantized() {
+		allocate(w.size());
+		float peak = 0;
+		for (size_t i = 0; i < w.size(); i++) peak = std::max(peak, std::fabs(w[i]));
+		factor = peak > 0 ? peak / limit : 1;
+		for (size_t i = 0; i < w.size(); i++) value[i] = type(std::lround(std::min(std::max(w[i] / factor, -1.0f * limit), 1.0f * limit)));
+	}
+	quantized(type* data, size_t len, float scale, const std::shared_ptr<void>& owner) : value(data), length(len), factor(scale), block(owner) {}
+
+	float operator[] (size_t i) const { return value[i] * factor; }
+	size_t size() const { return length; }
+	float scale() const { return factor; }
+	type* data() { return value; }
+	const type* data() const { return value; }
+
+public:
+	friend std::ostream& operator <<(std::ostream& out, const quantized& w) {
+		uint64_t size = w.size();
+		out.write(reinterpret_cast<const char*>(&size), sizeof(uint64_t));
+		out.write(reinterpret_cast<const char*>(&w.factor), sizeof(float));
+		out.write(reinterpret_cast<const char*>(w.data()), sizeof(type) * size);
+		return out;
+	}
+	friend std::istream& operator >>(std::istream& in, quantized& w) {
+		uint64_t size = 0;
+		in.read(reinterpret_cast<char*>(&size), sizeof(uint64_t));
+		w.allocate(size);
+		in.read(reinterpret_cast<char*>(&w.factor), sizeof(float));
+		in.read(reinterpret_cast<char*>(w.data()), sizeof(type) * size);
+		return in;
+	}
+
+protected:
+	void allocate(size_t len) {
+		length = len;
+		if (pages::mapped(sizeof(type) * (len + 1))) {
+			value = static_cast<type*>(pages::allocate(sizeof(type) * (len + 1), block));
+			return;
+		}
+		value = len ? new type[len + 1]() : nullptr;
+		block.reset(value, std::default_delete<type[]>());
+	}
+
+protected:
+	type* value;
+	size_t length;
+	float factor;
+	std::shared_ptr<void> block;
 };
@@ -0,0 +1,59 @@
+/**
+ * Framework for Threes! and its variants (C++ 11)
+ * xoshiro.h: Small fast pseudo-random number generator
+ *
+ * Author: Theory of Computer Games
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <cstdint>
+#include <limits>
+
+/**
+ * xoshiro256** (Blackman and Vigna), seeded by splitmix64
+ * it satisfies UniformRandomBitGenerator, so it also works with std::shuffle and the distributions
+ */
+class xoshiro {
+public:
+	typedef uint64_t result_type;
+
+	xoshiro(uint64_t seed = 0) { this->seed(seed); }
+
+	void seed(uint64_t seed) {
+		for (uint64_t& s : state) {
+			uint64_t z = (seed += 0x9e3779b97f4a7c15ull);
+			z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+			z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+			s = z ^ (z >> 31);
+		}
+	}
+
+	result_type operator()() {
+		uint64_t result = rotl(state[1] * 5, 7) * 9;
+		uint64_t t = state[1] << 17;
+		state[2] ^= state[0];
+		state[3] ^= state[1];
+		state[1] ^= state[2];
+		state[0] ^= state[3];
+		state[2] ^= t;
+		state[3] = rotl(state[3], 45);
+		return result;
+	}
+
+	/**
+	 * a number in [0, n) by multiplying the upper 32 bits, whose bias is negligible for small n
+	 */
+	uint32_t below(uint32_t n) {
+		return uint32_t(((operator()() >> 32) * n) >> 32);
+	}
+
+	static constexpr result_type min() { return 0; }
+	static constexpr result_type max() { return std::numeric_limits<result_type>::max(); }
+
+private:
+	static uint64_t rotl(uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+
+	uint64_t state[4];
+};